@@ -0,0 +1,148 @@
+#ifndef ERLPACK_ALLOCATOR_H__
+#define ERLPACK_ALLOCATOR_H__
+
+#include "encoder.h"
+
+#if defined(__cplusplus)
+#define ERLPACK_THREAD_LOCAL thread_local
+#elif defined(_MSC_VER)
+#define ERLPACK_THREAD_LOCAL __declspec(thread)
+#else
+#define ERLPACK_THREAD_LOCAL __thread
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ERLPACK_POOL_SLOTS 4
+#define ERLPACK_POOL_MAX_BLOCK (2 * 1024 * 1024)
+
+/*
+ * Thread-local pool: freed buffers up to `ERLPACK_POOL_MAX_BLOCK` bytes are
+ * parked in a small per-thread cache and handed back out by the next
+ * allocation that fits, so a pack per message does not round-trip through
+ * malloc. Anything larger goes straight back to the system.
+ */
+typedef struct erlpack_pool {
+  size_t count;
+  void *blocks[ERLPACK_POOL_SLOTS];
+  size_t sizes[ERLPACK_POOL_SLOTS];
+} erlpack_pool;
+
+static inline void erlpack_pool_trim(erlpack_pool *pool) {
+  for (size_t i = 0; i < pool->count; ++i)
+    free(pool->blocks[i]);
+
+  pool->count = 0;
+}
+
+#ifdef __cplusplus
+}
+
+// In C++ the cached blocks are released when the owning thread exits.
+struct erlpack_pool_owner {
+  erlpack_pool pool;
+  ~erlpack_pool_owner() { erlpack_pool_trim(&pool); }
+};
+
+static inline erlpack_pool *erlpack_pool_local(void) {
+  static ERLPACK_THREAD_LOCAL erlpack_pool_owner owner = {};
+  return &owner.pool;
+}
+
+extern "C" {
+#else
+static inline erlpack_pool *erlpack_pool_local(void) {
+  static ERLPACK_THREAD_LOCAL erlpack_pool pool;
+  return &pool;
+}
+#endif
+
+static inline void *erlpack_pool_alloc(void *ctx, size_t *size) {
+  erlpack_pool *pool = erlpack_pool_local();
+  (void)ctx;
+
+  for (size_t i = 0; i < pool->count; ++i) {
+    if (pool->sizes[i] >= *size) {
+      void *block = pool->blocks[i];
+      *size = pool->sizes[i];
+
+      pool->count--;
+      pool->blocks[i] = pool->blocks[pool->count];
+      pool->sizes[i] = pool->sizes[pool->count];
+      return block;
+    }
+  }
+
+  return malloc(*size);
+}
+
+static inline void *erlpack_pool_grow(void *ctx, void *ptr, size_t old_size,
+                                      size_t *new_size) {
+  (void)old_size;
+  if (ptr == NULL)
+    return erlpack_pool_alloc(ctx, new_size);
+
+  return realloc(ptr, *new_size);
+}
+
+static inline void erlpack_pool_free(void *ctx, void *ptr, size_t size) {
+  erlpack_pool *pool = erlpack_pool_local();
+  (void)ctx;
+
+  if (size <= ERLPACK_POOL_MAX_BLOCK && pool->count < ERLPACK_POOL_SLOTS) {
+    pool->blocks[pool->count] = ptr;
+    pool->sizes[pool->count] = size;
+    pool->count++;
+    return;
+  }
+
+  free(ptr);
+}
+
+static const erlpack_allocator erlpack_pool_allocator = {
+    erlpack_pool_alloc, erlpack_pool_grow, erlpack_pool_free, NULL};
+
+/*
+ * Fixed buffers write into memory owned by someone else, such as the final
+ * output object sized with the erlpack_sizeof_* functions. Writing past the
+ * end fails with -1 instead of growing.
+ */
+static inline void *erlpack_fixed_alloc(void *ctx, size_t *size) {
+  (void)ctx;
+  (void)size;
+  return NULL;
+}
+
+static inline void *erlpack_fixed_grow(void *ctx, void *ptr, size_t old_size,
+                                       size_t *new_size) {
+  (void)ctx;
+  (void)ptr;
+  (void)old_size;
+  (void)new_size;
+  return NULL;
+}
+
+static inline void erlpack_fixed_free(void *ctx, void *ptr, size_t size) {
+  (void)ctx;
+  (void)ptr;
+  (void)size;
+}
+
+static const erlpack_allocator erlpack_fixed_allocator = {
+    erlpack_fixed_alloc, erlpack_fixed_grow, erlpack_fixed_free, NULL};
+
+static inline void erlpack_buffer_init_fixed(erlpack_buffer *pk, char *buf,
+                                             size_t size) {
+  pk->buf = buf;
+  pk->length = 0;
+  pk->allocated_size = size;
+  pk->allocator = &erlpack_fixed_allocator;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ERLPACK_ALLOCATOR_H__ */
@@ -0,0 +1,132 @@
+#ifndef ERLPACK_ATOMS_H__
+#define ERLPACK_ATOMS_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "encoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Pre-encoded atoms. Hot atoms are encoded once, header included, and keyed
+ * by their name, so encoding one again is a lookup and a single memcpy no
+ * matter which object the binding holds for it. The table is direct-mapped
+ * like erlpack_intern_table: each name has a single slot and adding a name
+ * replaces whatever was there, so atoms that stop coming up make room for
+ * new ones and the table never holds more than `capacity` entries. Only
+ * atoms that fit the small atom formats are cached.
+ */
+typedef struct erlpack_atom_entry {
+  char *encoded; // NULL when the slot is empty
+  size_t length; // encoded length, header included
+  uint64_t hash;
+} erlpack_atom_entry;
+
+typedef struct erlpack_atom_table {
+  erlpack_atom_entry *entries;
+  size_t capacity; // a power of 2, or 0 when the table is disabled
+} erlpack_atom_table;
+
+// `capacity` is rounded up to a power of 2; 0 disables the table.
+static inline int erlpack_atom_table_init(erlpack_atom_table *t,
+                                          size_t capacity) {
+  t->entries = NULL;
+  t->capacity = 0;
+  if (capacity == 0)
+    return 0;
+
+  size_t rounded = 1;
+  while (rounded < capacity)
+    rounded <<= 1;
+
+  t->entries = (erlpack_atom_entry *)calloc(rounded, sizeof(erlpack_atom_entry));
+  if (!t->entries)
+    return -1;
+
+  t->capacity = rounded;
+  return 0;
+}
+
+static inline void erlpack_atom_table_free(erlpack_atom_table *t) {
+  for (size_t i = 0; i < t->capacity; ++i)
+    free(t->entries[i].encoded);
+
+  free(t->entries);
+  t->entries = NULL;
+  t->capacity = 0;
+}
+
+static inline uint64_t erlpack_atom_hash(const char *bytes, size_t size) {
+  // FNV-1a, which is plenty for names this short.
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= (uint8_t)bytes[i];
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+static inline erlpack_atom_entry *erlpack_atom_slot(const erlpack_atom_table *t,
+                                                    uint64_t hash) {
+  return &t->entries[(size_t)(hash ^ (hash >> 32)) & (t->capacity - 1)];
+}
+
+// Returns the entry of the atom named `bytes` (latin-1, or utf-8 when `utf8`
+// is set), or NULL.
+static inline const erlpack_atom_entry *
+erlpack_atom_table_find(const erlpack_atom_table *t, const char *bytes,
+                        size_t size, int utf8) {
+  if (t->capacity == 0)
+    return NULL;
+
+  const uint64_t hash = erlpack_atom_hash(bytes, size);
+  const erlpack_atom_entry *entry = erlpack_atom_slot(t, hash);
+  if (entry->encoded && entry->hash == hash && entry->length == 2 + size &&
+      entry->encoded[0] == (utf8 ? SMALL_ATOM_UTF8_EXT : SMALL_ATOM_EXT) &&
+      memcmp(entry->encoded + 2, bytes, size) == 0)
+    return entry;
+
+  return NULL;
+}
+
+// Encodes the atom `bytes` (latin-1, or utf-8 when `utf8` is set) and stores
+// it in its slot, replacing the atom that was there. Returns the new entry,
+// or NULL when the atom is not cached (the table is disabled, the atom is
+// too long, or memory ran out); the caller then just encodes it the regular
+// way.
+static inline const erlpack_atom_entry *
+erlpack_atom_table_add(erlpack_atom_table *t, const char *bytes, size_t size,
+                       int utf8) {
+  if (t->capacity == 0 || size >= 255)
+    return NULL;
+
+  char *encoded = (char *)malloc(2 + size);
+  if (!encoded)
+    return NULL;
+
+  encoded[0] = utf8 ? SMALL_ATOM_UTF8_EXT : SMALL_ATOM_EXT;
+  encoded[1] = (char)size;
+  memcpy(encoded + 2, bytes, size);
+
+  const uint64_t hash = erlpack_atom_hash(bytes, size);
+  erlpack_atom_entry *entry = erlpack_atom_slot(t, hash);
+  free(entry->encoded);
+  entry->encoded = encoded;
+  entry->length = 2 + size;
+  entry->hash = hash;
+  return entry;
+}
+
+static inline int erlpack_append_encoded_atom(erlpack_buffer *b,
+                                              const erlpack_atom_entry *entry) {
+  erlpack_append(b, entry->encoded, entry->length);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ERLPACK_ATOMS_H__ */
@@ -0,0 +1,131 @@
+#ifndef ERLPACK_COMPRESS_H__
+#define ERLPACK_COMPRESS_H__
+
+#include <string.h>
+#include <zlib.h>
+#include "encoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ERLPACK_DEFAULT_COMPRESS_LEVEL 6
+#define ERLPACK_DEFAULT_COMPRESS_THRESHOLD 1024
+
+/*
+ * Produces the COMPRESSED ('P') envelope that `term_to_binary(T, [compressed])`
+ * emits: the version byte, 'P', the UInt32 size of the uncompressed body and
+ * the zlib stream of that body. The deflate state is allocated once and reset
+ * between terms, so compressing many terms with one compressor does not pay
+ * for zlib's window and hash table allocations every time.
+ */
+typedef struct erlpack_compressor {
+  z_stream stream;
+  int level;
+  int initialized;
+} erlpack_compressor;
+
+static inline void erlpack_compressor_init(erlpack_compressor *c, int level) {
+  memset(&c->stream, 0, sizeof(c->stream));
+  c->level = level;
+  c->initialized = 0;
+}
+
+static inline void erlpack_compressor_free(erlpack_compressor *c) {
+  if (c->initialized)
+    deflateEnd(&c->stream);
+
+  c->initialized = 0;
+}
+
+static inline int erlpack_compress_level_valid(int level) {
+  return level >= Z_DEFAULT_COMPRESSION && level <= Z_BEST_COMPRESSION;
+}
+
+// Appends the COMPRESSED envelope of `term` (a complete encoded term,
+// starting with its version byte) to `out`. Returns 0 on success, 1 when
+// the envelope would not be smaller than `term` (nothing is appended and the
+// caller should keep the uncompressed term, as the VM does) and -1 when
+// memory runs out or zlib fails.
+static inline int erlpack_compress_term(erlpack_compressor *c, const char *term,
+                                        size_t length, erlpack_buffer *out) {
+  const size_t header = 6;
+  if (length <= header + 1 || length - 1 > 0xFFFFFFFFUL)
+    return 1;
+
+  const size_t body = length - 1;
+  if (!c->initialized) {
+    if (deflateInit(&c->stream, c->level) != Z_OK)
+      return -1;
+    c->initialized = 1;
+  } else if (deflateReset(&c->stream) != Z_OK) {
+    return -1;
+  }
+
+  if (out->length + length > out->allocated_size) {
+    if (erlpack_buffer_grow(out, out->length + length) < 0)
+      return -1;
+  }
+
+  unsigned char *dst = (unsigned char *)out->buf + out->length;
+  dst[0] = FORMAT_VERSION;
+  dst[1] = COMPRESSED;
+  _erlpack_store32(dst + 2, body);
+
+  // Only offer as much room as the uncompressed term takes up, so deflate
+  // stops early on data that does not compress.
+  c->stream.next_in = (Bytef *)(term + 1);
+  c->stream.avail_in = (uInt)body;
+  c->stream.next_out = dst + header;
+  c->stream.avail_out = (uInt)(length - header - 1);
+
+  const int ret = deflate(&c->stream, Z_FINISH);
+  if (ret == Z_OK || ret == Z_BUF_ERROR)
+    return 1;
+  if (ret != Z_STREAM_END)
+    return -1;
+
+  out->length += header + c->stream.total_out;
+  return 0;
+}
+
+// Deflate never shrinks data by more than about 1032:1, so a COMPRESSED term
+// whose declared size is beyond that ratio of the bytes left cannot be genuine.
+// Checking this before allocating keeps a few forged bytes from reserving
+// gigabytes for the inflated term.
+#define ERLPACK_MAX_DEFLATE_RATIO 1032
+
+static inline int erlpack_decompress_size_ok(size_t size, size_t available) {
+  return size / ERLPACK_MAX_DEFLATE_RATIO <= available;
+}
+
+// Inflates the zlib data of a COMPRESSED term, found at the start of the
+// `available` bytes at `data`, into the `size` bytes at `out`. Returns the
+// number of source bytes the zlib stream took up, or 0 when the data is
+// corrupt or does not inflate to exactly `size` bytes.
+static inline size_t erlpack_decompress_term(const uint8_t *data,
+                                             size_t available, uint8_t *out,
+                                             size_t size) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit(&stream) != Z_OK)
+    return 0;
+
+  stream.next_in = (Bytef *)data;
+  stream.avail_in = available > 0xFFFFFFFFUL ? 0xFFFFFFFFUL : (uInt)available;
+  stream.next_out = out;
+  stream.avail_out = (uInt)size;
+
+  const int ret = inflate(&stream, Z_FINISH);
+  const size_t consumed = stream.total_in;
+  const int complete = ret == Z_STREAM_END && stream.total_out == size;
+  inflateEnd(&stream);
+
+  return complete ? consumed : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ERLPACK_COMPRESS_H__ */
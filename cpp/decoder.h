@@ -0,0 +1,429 @@
+#ifndef ERLPACK_DECODER_H__
+#define ERLPACK_DECODER_H__
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "sysdep.h"
+#include "constants.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A binding-agnostic pull parser for the external term format.
+ *
+ * `erlpack_decoder_next` reads one term header at a time and yields a token.
+ * Scalars are fully described by their token, and binaries, atoms, strings and
+ * big integer magnitudes point straight into the source buffer (no copies are
+ * made, so the buffer must outlive the tokens). Containers only report their
+ * arity, so the caller pulls their children with further calls to
+ * `erlpack_decoder_next`. Every function returns 0 on success and -1 on
+ * failure, in which case `error` describes the first problem encountered.
+ */
+
+typedef enum erlpack_token_type {
+  ERLPACK_TOKEN_INTEGER,   // SMALL_INTEGER_EXT, INTEGER_EXT: `integer`
+  ERLPACK_TOKEN_FLOAT,     // FLOAT_EXT, NEW_FLOAT_EXT: `number`
+  ERLPACK_TOKEN_ATOM,      // ATOM_EXT, SMALL_ATOM_EXT: latin-1 `bytes`
+  ERLPACK_TOKEN_ATOM_UTF8, // ATOM_UTF8_EXT, SMALL_ATOM_UTF8_EXT: utf-8 `bytes`
+  ERLPACK_TOKEN_BINARY,    // BINARY_EXT: `bytes`
+  ERLPACK_TOKEN_STRING,    // STRING_EXT: `bytes`, one per list element
+  ERLPACK_TOKEN_BIG,       // SMALL_BIG_EXT, LARGE_BIG_EXT: little-endian magnitude in `bytes`, `sign`
+  ERLPACK_TOKEN_NIL,       // NIL_EXT
+  ERLPACK_TOKEN_LIST,      // LIST_EXT: `length` elements, then a tail
+  ERLPACK_TOKEN_TUPLE,     // SMALL_TUPLE_EXT, LARGE_TUPLE_EXT: `length` elements
+  ERLPACK_TOKEN_MAP,       // MAP_EXT: `length` key/value pairs
+  ERLPACK_TOKEN_REFERENCE, // REFERENCE_EXT: node term, UInt32 id, UInt8 creation follow
+  ERLPACK_TOKEN_NEW_REFERENCE, // NEW_REFERENCE_EXT: node term, UInt8 creation, `length` UInt32 ids follow
+  ERLPACK_TOKEN_PORT,      // PORT_EXT: node term, UInt32 id, UInt8 creation follow
+  ERLPACK_TOKEN_PID,       // PID_EXT: node term, UInt32 id, UInt32 serial, UInt8 creation follow
+  ERLPACK_TOKEN_EXPORT,    // EXPORT_EXT: module, function and arity terms follow
+  ERLPACK_TOKEN_COMPRESSED // COMPRESSED: `length` uncompressed bytes, zlib data starts at `bytes`
+} erlpack_token_type;
+
+typedef struct erlpack_token {
+  erlpack_token_type type;
+  unsigned char tag;
+  int sign;
+  int64_t integer;
+  double number;
+  const uint8_t *bytes;
+  size_t length;
+} erlpack_token;
+
+typedef struct erlpack_decoder {
+  const uint8_t *data;
+  size_t size;
+  size_t offset;
+  const char *error;
+  void *source; // left to the binding, such as the object that owns `data`
+} erlpack_decoder;
+
+static inline void erlpack_decoder_init(erlpack_decoder *d, const uint8_t *data,
+                                        size_t size) {
+  d->data = data;
+  d->size = size;
+  d->offset = 0;
+  d->error = NULL;
+  d->source = NULL;
+}
+
+static inline int erlpack_decoder_fail(erlpack_decoder *d, const char *msg) {
+  // Keep the first error, it is the one closest to the actual problem.
+  if (d->error == NULL)
+    d->error = msg;
+  return -1;
+}
+
+static inline int erlpack_decoder_read8(erlpack_decoder *d, uint8_t *out) {
+  if (d->offset + sizeof(uint8_t) > d->size)
+    return erlpack_decoder_fail(d, "Reading a byte passes the end of the buffer.");
+
+  *out = d->data[d->offset];
+  d->offset += sizeof(uint8_t);
+  return 0;
+}
+
+static inline int erlpack_decoder_read16(erlpack_decoder *d, uint16_t *out) {
+  if (d->offset + sizeof(uint16_t) > d->size)
+    return erlpack_decoder_fail(d, "Reading two bytes passes the end of the buffer.");
+
+  uint16_t val;
+  memcpy(&val, d->data + d->offset, sizeof(val));
+  *out = _erlpack_be16(val);
+  d->offset += sizeof(uint16_t);
+  return 0;
+}
+
+static inline int erlpack_decoder_read32(erlpack_decoder *d, uint32_t *out) {
+  if (d->offset + sizeof(uint32_t) > d->size)
+    return erlpack_decoder_fail(d, "Reading three bytes passes the end of the buffer.");
+
+  uint32_t val;
+  memcpy(&val, d->data + d->offset, sizeof(val));
+  *out = _erlpack_be32(val);
+  d->offset += sizeof(uint32_t);
+  return 0;
+}
+
+static inline int erlpack_decoder_read64(erlpack_decoder *d, uint64_t *out) {
+  if (d->offset + sizeof(uint64_t) > d->size)
+    return erlpack_decoder_fail(d, "Reading four bytes passes the end of the buffer.");
+
+  uint64_t val;
+  memcpy(&val, d->data + d->offset, sizeof(val));
+  *out = _erlpack_be64(val);
+  d->offset += sizeof(uint64_t);
+  return 0;
+}
+
+static inline int erlpack_decoder_read_bytes(erlpack_decoder *d, size_t length,
+                                             const uint8_t **out) {
+  if (length > d->size - d->offset)
+    return erlpack_decoder_fail(d, "Reading sequence past the end of the buffer.");
+
+  *out = d->data + d->offset;
+  d->offset += length;
+  return 0;
+}
+
+static inline int erlpack_decoder_read_version(erlpack_decoder *d) {
+  uint8_t version;
+  if (erlpack_decoder_read8(d, &version) < 0)
+    return -1;
+
+  if (version != FORMAT_VERSION)
+    return erlpack_decoder_fail(d, "Bad version number.");
+
+  return 0;
+}
+
+// Reads the NIL_EXT that terminates a LIST_EXT once its elements are consumed.
+static inline int erlpack_decoder_read_tail(erlpack_decoder *d) {
+  uint8_t tail;
+  if (erlpack_decoder_read8(d, &tail) < 0)
+    return -1;
+
+  if (tail != NIL_EXT)
+    return erlpack_decoder_fail(d, "List doesn't end with a tail marker, but it must!");
+
+  return 0;
+}
+
+static inline int erlpack_decoder_read_float_string(erlpack_decoder *d,
+                                                    double *out) {
+  const size_t FLOAT_LENGTH = 31;
+  const uint8_t *str;
+  if (erlpack_decoder_read_bytes(d, FLOAT_LENGTH, &str) < 0)
+    return -1;
+
+  char terminated[32] = {0};
+  memcpy(terminated, str, FLOAT_LENGTH);
+  if (sscanf(terminated, "%lf", out) != 1)
+    return erlpack_decoder_fail(d, "Invalid float encoded.");
+
+  return 0;
+}
+
+static inline int erlpack_decoder_next(erlpack_decoder *d, erlpack_token *tok) {
+  uint8_t u8;
+  uint16_t u16;
+  uint32_t u32;
+  uint64_t u64;
+
+  if (d->error != NULL)
+    return -1;
+
+  if (d->offset >= d->size)
+    return erlpack_decoder_fail(d, "Unpacking beyond the end of the buffer");
+
+  tok->tag = d->data[d->offset++];
+  tok->sign = 0;
+  tok->integer = 0;
+  tok->number = 0;
+  tok->bytes = NULL;
+  tok->length = 0;
+
+  switch (tok->tag) {
+  case SMALL_INTEGER_EXT:
+    tok->type = ERLPACK_TOKEN_INTEGER;
+    if (erlpack_decoder_read8(d, &u8) < 0)
+      return -1;
+    tok->integer = u8;
+    return 0;
+
+  case INTEGER_EXT:
+    tok->type = ERLPACK_TOKEN_INTEGER;
+    if (erlpack_decoder_read32(d, &u32) < 0)
+      return -1;
+    tok->integer = (int32_t)u32;
+    return 0;
+
+  case FLOAT_EXT:
+    tok->type = ERLPACK_TOKEN_FLOAT;
+    return erlpack_decoder_read_float_string(d, &tok->number);
+
+  case NEW_FLOAT_EXT: {
+    tok->type = ERLPACK_TOKEN_FLOAT;
+    if (erlpack_decoder_read64(d, &u64) < 0)
+      return -1;
+    memcpy(&tok->number, &u64, sizeof(double));
+    return 0;
+  }
+
+  case ATOM_EXT:
+  case ATOM_UTF8_EXT:
+    tok->type = tok->tag == ATOM_EXT ? ERLPACK_TOKEN_ATOM : ERLPACK_TOKEN_ATOM_UTF8;
+    if (erlpack_decoder_read16(d, &u16) < 0)
+      return -1;
+    tok->length = u16;
+    return erlpack_decoder_read_bytes(d, tok->length, &tok->bytes);
+
+  case SMALL_ATOM_EXT:
+  case SMALL_ATOM_UTF8_EXT:
+    tok->type = tok->tag == SMALL_ATOM_EXT ? ERLPACK_TOKEN_ATOM : ERLPACK_TOKEN_ATOM_UTF8;
+    if (erlpack_decoder_read8(d, &u8) < 0)
+      return -1;
+    tok->length = u8;
+    return erlpack_decoder_read_bytes(d, tok->length, &tok->bytes);
+
+  case BINARY_EXT:
+    tok->type = ERLPACK_TOKEN_BINARY;
+    if (erlpack_decoder_read32(d, &u32) < 0)
+      return -1;
+    tok->length = u32;
+    return erlpack_decoder_read_bytes(d, tok->length, &tok->bytes);
+
+  case STRING_EXT:
+    tok->type = ERLPACK_TOKEN_STRING;
+    if (erlpack_decoder_read16(d, &u16) < 0)
+      return -1;
+    tok->length = u16;
+    return erlpack_decoder_read_bytes(d, tok->length, &tok->bytes);
+
+  case SMALL_BIG_EXT:
+  case LARGE_BIG_EXT:
+    tok->type = ERLPACK_TOKEN_BIG;
+    if (tok->tag == SMALL_BIG_EXT) {
+      if (erlpack_decoder_read8(d, &u8) < 0)
+        return -1;
+      tok->length = u8;
+    } else {
+      if (erlpack_decoder_read32(d, &u32) < 0)
+        return -1;
+      tok->length = u32;
+    }
+    if (erlpack_decoder_read8(d, &u8) < 0)
+      return -1;
+    tok->sign = u8 != 0;
+    return erlpack_decoder_read_bytes(d, tok->length, &tok->bytes);
+
+  case NIL_EXT:
+    tok->type = ERLPACK_TOKEN_NIL;
+    return 0;
+
+  case LIST_EXT:
+    tok->type = ERLPACK_TOKEN_LIST;
+    if (erlpack_decoder_read32(d, &u32) < 0)
+      return -1;
+    tok->length = u32;
+    return 0;
+
+  case SMALL_TUPLE_EXT:
+    tok->type = ERLPACK_TOKEN_TUPLE;
+    if (erlpack_decoder_read8(d, &u8) < 0)
+      return -1;
+    tok->length = u8;
+    return 0;
+
+  case LARGE_TUPLE_EXT:
+    tok->type = ERLPACK_TOKEN_TUPLE;
+    if (erlpack_decoder_read32(d, &u32) < 0)
+      return -1;
+    tok->length = u32;
+    return 0;
+
+  case MAP_EXT:
+    tok->type = ERLPACK_TOKEN_MAP;
+    if (erlpack_decoder_read32(d, &u32) < 0)
+      return -1;
+    tok->length = u32;
+    return 0;
+
+  case REFERENCE_EXT:
+    tok->type = ERLPACK_TOKEN_REFERENCE;
+    return 0;
+
+  case NEW_REFERENCE_EXT:
+    tok->type = ERLPACK_TOKEN_NEW_REFERENCE;
+    if (erlpack_decoder_read16(d, &u16) < 0)
+      return -1;
+    tok->length = u16;
+    return 0;
+
+  case PORT_EXT:
+    tok->type = ERLPACK_TOKEN_PORT;
+    return 0;
+
+  case PID_EXT:
+    tok->type = ERLPACK_TOKEN_PID;
+    return 0;
+
+  case EXPORT_EXT:
+    tok->type = ERLPACK_TOKEN_EXPORT;
+    return 0;
+
+  case COMPRESSED:
+    tok->type = ERLPACK_TOKEN_COMPRESSED;
+    if (erlpack_decoder_read32(d, &u32) < 0)
+      return -1;
+    tok->length = u32;
+    tok->bytes = d->data + d->offset;
+    return 0;
+
+  default:
+    return erlpack_decoder_fail(d, "Unsupported erlang term type identifier found");
+  }
+}
+
+// Reads the node atom of a REFERENCE, PORT or PID, then skips the `fixed`
+// bytes of ids and creation that follow it.
+static inline int erlpack_decoder_skip_node(erlpack_decoder *d, size_t fixed) {
+  erlpack_token node;
+  const uint8_t *bytes;
+  if (erlpack_decoder_next(d, &node) < 0)
+    return -1;
+
+  if (node.type != ERLPACK_TOKEN_ATOM && node.type != ERLPACK_TOKEN_ATOM_UTF8)
+    return erlpack_decoder_fail(d, "Expected an atom as the node of an identifier.");
+
+  return erlpack_decoder_read_bytes(d, fixed, &bytes);
+}
+
+/*
+ * Moves past one complete term without building anything from it, for
+ * decoders that only decode the parts of a term that get used. Containers
+ * are walked with a count of the terms still to skip rather than by
+ * recursion, so nesting depth costs nothing. A COMPRESSED term cannot be
+ * skipped without inflating it and fails.
+ */
+static inline int erlpack_decoder_skip(erlpack_decoder *d) {
+  size_t remaining = 1;
+  erlpack_token tok;
+
+  while (remaining > 0) {
+    if (erlpack_decoder_next(d, &tok) < 0)
+      return -1;
+    remaining--;
+
+    size_t children = 0;
+    int ret = 0;
+    switch (tok.type) {
+    case ERLPACK_TOKEN_LIST:
+      children = tok.length + 1; // the tail
+      break;
+    case ERLPACK_TOKEN_TUPLE:
+      children = tok.length;
+      break;
+    case ERLPACK_TOKEN_MAP:
+      children = tok.length;
+      if (children > (d->size - d->offset) / 2)
+        return erlpack_decoder_fail(d, "Container arity passes the end of the buffer.");
+      children *= 2;
+      break;
+    case ERLPACK_TOKEN_EXPORT:
+      children = 3;
+      break;
+    case ERLPACK_TOKEN_REFERENCE:
+      ret = erlpack_decoder_skip_node(d, 5);
+      break;
+    case ERLPACK_TOKEN_NEW_REFERENCE:
+      ret = erlpack_decoder_skip_node(d, 1 + 4 * tok.length);
+      break;
+    case ERLPACK_TOKEN_PORT:
+      ret = erlpack_decoder_skip_node(d, 5);
+      break;
+    case ERLPACK_TOKEN_PID:
+      ret = erlpack_decoder_skip_node(d, 9);
+      break;
+    case ERLPACK_TOKEN_COMPRESSED:
+      return erlpack_decoder_fail(d, "Cannot skip over a compressed term.");
+    default:
+      break;
+    }
+
+    if (ret < 0)
+      return -1;
+
+    // Every term left to skip takes up at least one byte.
+    const size_t left = d->size - d->offset;
+    if (remaining > left || children > left - remaining)
+      return erlpack_decoder_fail(d, "Container arity passes the end of the buffer.");
+    remaining += children;
+  }
+
+  return 0;
+}
+
+// Number of 64-bit words needed to hold the magnitude of a BIG token.
+static inline size_t erlpack_big_word_count(const erlpack_token *tok) {
+  return (tok->length + 7) / 8;
+}
+
+// Repacks the little-endian magnitude of a BIG token into 64-bit words,
+// least significant first, which is what BigInt constructors take.
+static inline void erlpack_big_to_words(const erlpack_token *tok,
+                                        uint64_t *words) {
+  memset(words, 0, erlpack_big_word_count(tok) * sizeof(uint64_t));
+  for (size_t i = 0; i < tok->length; ++i)
+    words[i / 8] |= (uint64_t)tok->bytes[i] << (8 * (i % 8));
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ERLPACK_DECODER_H__ */
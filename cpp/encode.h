@@ -0,0 +1,312 @@
+#ifndef ERLPACK_ENCODE_H__
+#define ERLPACK_ENCODE_H__
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "encoder.h"
+
+/*
+ * Header-only C++17 encoding on top of the erlpack_append_* primitives.
+ * `erlpack::encode(b, value)` picks the term for `value` from its static
+ * type, so there is no runtime dispatch:
+ *
+ *   bool                        true / false
+ *   integers, __int128          SMALL_INTEGER_EXT, INTEGER_EXT or
+ *                               SMALL_BIG_EXT, the smallest that holds it
+ *   floating point              NEW_FLOAT_EXT
+ *   std::string(_view), char*   BINARY_EXT
+ *   erlpack::atom               SMALL_ATOM_UTF8_EXT / ATOM_UTF8_EXT
+ *   std::nullptr_t, nullopt     nil
+ *   std::optional<T>            T, or nil when empty
+ *   std::variant<Ts...>         the alternative it holds
+ *   std::vector<T>              a list
+ *   std::map, unordered_map     a map
+ *   std::pair, std::tuple       a tuple
+ *
+ * Other types are encoded by specializing erlpack::encoder:
+ *
+ *   template <> struct erlpack::encoder<Point> {
+ *     static int encode(erlpack_buffer *b, const Point &p) {
+ *       return erlpack::encode(b, std::tie(p.x, p.y));
+ *     }
+ *   };
+ *
+ * Like the C functions, encode returns 0 on success, -1 when the buffer
+ * cannot grow and 1 when the value cannot be represented.
+ */
+namespace erlpack {
+
+// An atom, as opposed to a string, which encodes as a binary.
+struct atom {
+  std::string_view name;
+
+  constexpr explicit atom(std::string_view name) : name(name) {}
+};
+
+template <typename T, typename Enable = void>
+struct encoder;
+
+template <typename T>
+inline int encode(erlpack_buffer *b, const T &value) {
+  return encoder<T>::encode(b, value);
+}
+
+namespace detail {
+
+template <typename T>
+inline int encode_each(erlpack_buffer *b, const T &items) {
+  for (const auto &item : items) {
+    int ret = erlpack::encode(b, item);
+    if (ret != 0)
+      return ret;
+  }
+  return 0;
+}
+
+template <typename Map>
+inline int encode_map(erlpack_buffer *b, const Map &map) {
+  int ret = erlpack_append_map_header(b, map.size());
+  if (ret != 0)
+    return ret;
+
+  for (const auto &entry : map) {
+    ret = erlpack::encode(b, entry.first);
+    if (ret != 0)
+      return ret;
+
+    ret = erlpack::encode(b, entry.second);
+    if (ret != 0)
+      return ret;
+  }
+  return 0;
+}
+
+template <typename Tuple, size_t... I>
+inline int encode_tuple(erlpack_buffer *b, const Tuple &tuple,
+                        std::index_sequence<I...>) {
+  int ret = erlpack_append_tuple_header(b, sizeof...(I));
+  // Stops at the first element that fails.
+  (void)((ret == 0 && (ret = erlpack::encode(b, std::get<I>(tuple))) == 0) &&
+         ...);
+  return ret;
+}
+
+} // namespace detail
+
+template <>
+struct encoder<bool> {
+  static int encode(erlpack_buffer *b, bool value) {
+    return value ? erlpack_append_true(b) : erlpack_append_false(b);
+  }
+};
+
+template <typename T>
+struct encoder<T, std::enable_if_t<std::is_integral_v<T> &&
+                                   !std::is_same_v<T, bool> &&
+                                   sizeof(T) <= sizeof(long long)>> {
+  static int encode(erlpack_buffer *b, T value) {
+    if (value >= 0 && static_cast<std::make_unsigned_t<T>>(value) <= 255)
+      return erlpack_append_small_integer(b, static_cast<unsigned char>(value));
+
+    // Types no wider than 32 bits never need the SMALL_BIG_EXT branch.
+    if constexpr (std::is_signed_v<T>) {
+      if constexpr (sizeof(T) <= sizeof(int32_t)) {
+        return erlpack_append_integer(b, static_cast<int32_t>(value));
+      } else {
+        if (value >= std::numeric_limits<int32_t>::min() &&
+            value <= std::numeric_limits<int32_t>::max())
+          return erlpack_append_integer(b, static_cast<int32_t>(value));
+        return erlpack_append_long_long(b, static_cast<long long>(value));
+      }
+    } else {
+      if constexpr (sizeof(T) < sizeof(int32_t)) {
+        return erlpack_append_integer(b, static_cast<int32_t>(value));
+      } else {
+        if (value <= static_cast<uint32_t>(std::numeric_limits<int32_t>::max()))
+          return erlpack_append_integer(b, static_cast<int32_t>(value));
+        return erlpack_append_unsigned_long_long(
+            b, static_cast<unsigned long long>(value));
+      }
+    }
+  }
+};
+
+#ifdef __SIZEOF_INT128__
+namespace detail {
+__extension__ typedef __int128 int128;
+__extension__ typedef unsigned __int128 uint128;
+
+inline int encode_uint128(erlpack_buffer *b, uint128 magnitude, int sign) {
+  unsigned char digits[16];
+  for (size_t i = 0; i < sizeof(digits); ++i)
+    digits[i] = static_cast<unsigned char>(magnitude >> (8 * i));
+  return erlpack_append_big(b, digits, sizeof(digits), sign);
+}
+} // namespace detail
+
+template <>
+struct encoder<detail::uint128> {
+  static int encode(erlpack_buffer *b, detail::uint128 value) {
+    if (value <= std::numeric_limits<unsigned long long>::max())
+      return erlpack::encode(b, static_cast<unsigned long long>(value));
+    return detail::encode_uint128(b, value, 0);
+  }
+};
+
+template <>
+struct encoder<detail::int128> {
+  static int encode(erlpack_buffer *b, detail::int128 value) {
+    if (value >= std::numeric_limits<long long>::min() &&
+        value <= std::numeric_limits<long long>::max())
+      return erlpack::encode(b, static_cast<long long>(value));
+
+    detail::uint128 magnitude = static_cast<detail::uint128>(value);
+    return detail::encode_uint128(b, value < 0 ? 0 - magnitude : magnitude,
+                                  value < 0);
+  }
+};
+#endif
+
+template <typename T>
+struct encoder<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+  static int encode(erlpack_buffer *b, T value) {
+    return erlpack_append_double(b, static_cast<double>(value));
+  }
+};
+
+template <>
+struct encoder<std::string_view> {
+  static int encode(erlpack_buffer *b, std::string_view value) {
+    return erlpack_append_binary(b, value.data(), value.size());
+  }
+};
+
+template <>
+struct encoder<std::string> : encoder<std::string_view> {};
+
+template <>
+struct encoder<const char *> {
+  static int encode(erlpack_buffer *b, const char *value) {
+    return erlpack_append_binary(b, value, strlen(value));
+  }
+};
+
+template <>
+struct encoder<char *> : encoder<const char *> {};
+
+template <size_t N>
+struct encoder<char[N]> {
+  static int encode(erlpack_buffer *b, const char (&value)[N]) {
+    return erlpack_append_binary(b, value, strlen(value));
+  }
+};
+
+template <>
+struct encoder<atom> {
+  static int encode(erlpack_buffer *b, atom value) {
+    return erlpack_append_atom_utf8(b, value.name.data(), value.name.size());
+  }
+};
+
+template <>
+struct encoder<std::nullptr_t> {
+  static int encode(erlpack_buffer *b, std::nullptr_t) {
+    return erlpack_append_nil(b);
+  }
+};
+
+template <>
+struct encoder<std::nullopt_t> {
+  static int encode(erlpack_buffer *b, std::nullopt_t) {
+    return erlpack_append_nil(b);
+  }
+};
+
+template <typename T>
+struct encoder<std::optional<T>> {
+  static int encode(erlpack_buffer *b, const std::optional<T> &value) {
+    if (!value)
+      return erlpack_append_nil(b);
+    return erlpack::encode(b, *value);
+  }
+};
+
+template <typename... Ts>
+struct encoder<std::variant<Ts...>> {
+  static int encode(erlpack_buffer *b, const std::variant<Ts...> &value) {
+    return std::visit(
+        [b](const auto &alternative) { return erlpack::encode(b, alternative); },
+        value);
+  }
+};
+
+template <typename T, typename Alloc>
+struct encoder<std::vector<T, Alloc>> {
+  static int encode(erlpack_buffer *b, const std::vector<T, Alloc> &value) {
+    if (value.empty())
+      return erlpack_append_nil_ext(b);
+
+    int ret = erlpack_append_list_header(b, value.size());
+    if (ret != 0)
+      return ret;
+
+    ret = detail::encode_each(b, value);
+    if (ret != 0)
+      return ret;
+
+    return erlpack_append_nil_ext(b);
+  }
+};
+
+template <typename K, typename V, typename Compare, typename Alloc>
+struct encoder<std::map<K, V, Compare, Alloc>> {
+  static int encode(erlpack_buffer *b,
+                    const std::map<K, V, Compare, Alloc> &value) {
+    return detail::encode_map(b, value);
+  }
+};
+
+template <typename K, typename V, typename Hash, typename Eq, typename Alloc>
+struct encoder<std::unordered_map<K, V, Hash, Eq, Alloc>> {
+  static int encode(erlpack_buffer *b,
+                    const std::unordered_map<K, V, Hash, Eq, Alloc> &value) {
+    return detail::encode_map(b, value);
+  }
+};
+
+template <typename... Ts>
+struct encoder<std::tuple<Ts...>> {
+  static int encode(erlpack_buffer *b, const std::tuple<Ts...> &value) {
+    return detail::encode_tuple(b, value, std::index_sequence_for<Ts...>{});
+  }
+};
+
+template <typename A, typename B>
+struct encoder<std::pair<A, B>> {
+  static int encode(erlpack_buffer *b, const std::pair<A, B> &value) {
+    return detail::encode_tuple(b, value, std::index_sequence<0, 1>{});
+  }
+};
+
+// Encodes a complete term: the version byte followed by `value`.
+template <typename T>
+inline int encode_term(erlpack_buffer *b, const T &value) {
+  int ret = erlpack_append_version(b);
+  if (ret != 0)
+    return ret;
+  return erlpack::encode(b, value);
+}
+
+} // namespace erlpack
+
+#endif /* ERLPACK_ENCODE_H__ */
@@ -1,3 +1,6 @@
+#ifndef ERLPACK_ENCODER_H__
+#define ERLPACK_ENCODER_H__
+
 #include <stddef.h>
 #include <stdlib.h>
 #include "sysdep.h"
@@ -9,33 +12,98 @@
 extern "C" {
 #endif
 
+/*
+ * Memory for an erlpack_buffer comes from an allocator. `alloc` and `grow`
+ * receive the requested size and may round it up, writing back the usable
+ * size. `grow` must leave the old block untouched when it fails. A buffer
+ * without an allocator uses malloc/realloc/free.
+ */
+typedef struct erlpack_allocator {
+  void *(*alloc)(void *ctx, size_t *size);
+  void *(*grow)(void *ctx, void *ptr, size_t old_size, size_t *new_size);
+  void (*free)(void *ctx, void *ptr, size_t size);
+  void *ctx;
+} erlpack_allocator;
+
 typedef struct erlpack_buffer {
   char *buf;
   size_t length;
   size_t allocated_size;
+  const erlpack_allocator *allocator;
 } erlpack_buffer;
 
-static inline int erlpack_buffer_write(erlpack_buffer *pk, const char *bytes,
-                                       size_t l) {
-  char *buf = pk->buf;
-  size_t allocated_size = pk->allocated_size;
-  size_t length = pk->length;
+static inline int erlpack_buffer_init(erlpack_buffer *pk,
+                                      const erlpack_allocator *allocator,
+                                      size_t initial_size) {
+  pk->buf = NULL;
+  pk->length = 0;
+  pk->allocated_size = 0;
+  pk->allocator = allocator;
 
-  if (length + l > allocated_size) {
-    // Grow buffer 2x to avoid excessive re-allocations.
-    allocated_size = (length + l) * 2;
-    buf = (char *)realloc(buf, allocated_size);
+  if (initial_size == 0)
+    return 0;
 
-    if (!buf)
-      return -1;
+  char *buf;
+  if (allocator)
+    buf = (char *)allocator->alloc(allocator->ctx, &initial_size);
+  else
+    buf = (char *)malloc(initial_size);
+
+  if (!buf)
+    return -1;
+
+  pk->buf = buf;
+  pk->allocated_size = initial_size;
+  return 0;
+}
+
+static inline void erlpack_buffer_free(erlpack_buffer *pk) {
+  if (pk->buf) {
+    if (pk->allocator)
+      pk->allocator->free(pk->allocator->ctx, pk->buf, pk->allocated_size);
+    else
+      free(pk->buf);
   }
 
-  memcpy(buf + length, bytes, l);
-  length += l;
+  pk->buf = NULL;
+  pk->length = 0;
+  pk->allocated_size = 0;
+}
+
+static inline int erlpack_buffer_grow(erlpack_buffer *pk, size_t required) {
+  // Grow buffer 2x to avoid excessive re-allocations.
+  size_t allocated_size = required * 2;
+  char *buf;
+
+  if (pk->allocator)
+    buf = (char *)pk->allocator->grow(pk->allocator->ctx, pk->buf,
+                                      pk->allocated_size, &allocated_size);
+  else
+    buf = (char *)realloc(pk->buf, allocated_size);
+
+  if (!buf)
+    return -1;
 
   pk->buf = buf;
   pk->allocated_size = allocated_size;
-  pk->length = length;
+  return 0;
+}
+
+// Makes room for `l` more bytes past `length`.
+static inline int erlpack_buffer_reserve(erlpack_buffer *pk, size_t l) {
+  if (pk->length + l > pk->allocated_size)
+    return erlpack_buffer_grow(pk, pk->length + l);
+
+  return 0;
+}
+
+static inline int erlpack_buffer_write(erlpack_buffer *pk, const char *bytes,
+                                       size_t l) {
+  if (erlpack_buffer_reserve(pk, l) < 0)
+    return -1;
+
+  memcpy(pk->buf + pk->length, bytes, l);
+  pk->length += l;
   return 0;
 }
 
@@ -106,6 +174,75 @@ static inline int erlpack_append_long_long(erlpack_buffer *b, long long d) {
   erlpack_append(b, buf, 1 + 2 + bytes_enc);
 }
 
+static inline int erlpack_append_big_header(erlpack_buffer *b, size_t size,
+                                            int sign) {
+  if (size <= 255) {
+    unsigned char buf[3] = {SMALL_BIG_EXT, (unsigned char)size,
+                            (unsigned char)(sign ? 1 : 0)};
+    erlpack_append(b, buf, 3);
+  } else {
+    unsigned char buf[6];
+    buf[0] = LARGE_BIG_EXT;
+    _erlpack_store32(buf + 1, size);
+    buf[5] = sign ? 1 : 0;
+    erlpack_append(b, buf, 6);
+  }
+}
+
+// Integers of any size, as a little-endian magnitude of `size` bytes and a
+// sign. Leading zero bytes are dropped, so the encoding is the one Erlang
+// itself produces.
+static inline int erlpack_append_big(erlpack_buffer *b,
+                                     const unsigned char *digits, size_t size,
+                                     int sign) {
+  while (size > 0 && digits[size - 1] == 0)
+    size--;
+
+  if (size > 0xFFFFFFFF)
+    return 1;
+
+  int ret = erlpack_append_big_header(b, size, sign);
+  if (ret < 0)
+    return ret;
+
+  erlpack_append(b, digits, size);
+}
+
+// Number of significant bytes in a magnitude held in 64-bit words, least
+// significant first (the layout of V8's BigInt::ToWordsArray).
+static inline size_t erlpack_big_words_length(const uint64_t *words,
+                                              size_t count) {
+  while (count > 0 && words[count - 1] == 0)
+    count--;
+
+  size_t size = count * 8;
+  if (count > 0) {
+    for (uint64_t top = words[count - 1]; (top >> 56) == 0; top <<= 8)
+      size--;
+  }
+  return size;
+}
+
+// Same as erlpack_append_big, for a magnitude held in 64-bit words.
+static inline int erlpack_append_big_words(erlpack_buffer *b,
+                                           const uint64_t *words, size_t count,
+                                           int sign) {
+  size_t size = erlpack_big_words_length(words, count);
+  if (size > 0xFFFFFFFF)
+    return 1;
+
+  int ret = erlpack_append_big_header(b, size, sign);
+  if (ret < 0 || erlpack_buffer_reserve(b, size) < 0)
+    return -1;
+
+  unsigned char *out = (unsigned char *)b->buf + b->length;
+  for (size_t i = 0; i < size; ++i)
+    out[i] = (unsigned char)(words[i / 8] >> (8 * (i % 8)));
+
+  b->length += size;
+  return 0;
+}
+
 typedef union {
   uint64_t ui64;
   double df;
@@ -231,7 +368,65 @@ static inline int erlpack_append_map_header(erlpack_buffer *b, size_t size) {
   erlpack_append(b, buf, 5);
 }
 
+// Streamed lists and maps are written with a placeholder arity that is filled
+// in once the last element is encoded. `offset` is where the LIST_EXT or
+// MAP_EXT header starts (the buffer may move while elements are appended).
+static inline void erlpack_patch_header_size(erlpack_buffer *b, size_t offset,
+                                             size_t size) {
+  _erlpack_store32((unsigned char *)b->buf + offset + 1, size);
+}
+
+/*
+ * Exact encoded sizes, matching what the corresponding erlpack_append_*
+ * function writes. Summing these over a term lets the output be allocated
+ * once, at its final size.
+ */
+static inline size_t erlpack_sizeof_version(void) { return 1; }
+static inline size_t erlpack_sizeof_nil(void) { return 5; }
+static inline size_t erlpack_sizeof_false(void) { return 7; }
+static inline size_t erlpack_sizeof_true(void) { return 6; }
+static inline size_t erlpack_sizeof_small_integer(void) { return 2; }
+static inline size_t erlpack_sizeof_integer(void) { return 5; }
+static inline size_t erlpack_sizeof_double(void) { return 1 + 8; }
+static inline size_t erlpack_sizeof_nil_ext(void) { return 1; }
+static inline size_t erlpack_sizeof_list_header(void) { return 5; }
+static inline size_t erlpack_sizeof_map_header(void) { return 5; }
+
+static inline size_t erlpack_sizeof_unsigned_long_long(unsigned long long d) {
+  size_t bytes_enc = 0;
+  while (d > 0) {
+    d >>= 8;
+    bytes_enc++;
+  }
+  return 1 + 2 + bytes_enc;
+}
+
+static inline size_t erlpack_sizeof_long_long(long long d) {
+  return erlpack_sizeof_unsigned_long_long(d < 0 ? 0ULL - (unsigned long long)d : (unsigned long long)d);
+}
+
+static inline size_t erlpack_sizeof_atom(size_t size) {
+  return size < 255 ? 2 + size : 3 + size;
+}
+
+static inline size_t erlpack_sizeof_atom_utf8(size_t size) {
+  return size < 255 ? 2 + size : 3 + size;
+}
+
+static inline size_t erlpack_sizeof_binary(size_t size) { return 5 + size; }
+static inline size_t erlpack_sizeof_string(size_t size) { return 3 + size; }
+
+static inline size_t erlpack_sizeof_big(size_t size) {
+  return size <= 255 ? 3 + size : 6 + size;
+}
+
+static inline size_t erlpack_sizeof_tuple_header(size_t size) {
+  return size < 256 ? 2 : 5;
+}
+
 #ifdef __cplusplus
 }
 
 #endif
+
+#endif /* ERLPACK_ENCODER_H__ */
@@ -0,0 +1,175 @@
+#ifndef ERLPACK_FRAGMENT_H__
+#define ERLPACK_FRAGMENT_H__
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include "encode.h"
+
+/*
+ * Pre-encoded term fragments built at compile time. Static parts of a
+ * message, such as envelope keys, constant atoms and fixed tuple or map
+ * headers, become a std::array<uint8_t, N> in the binary, and encoding one
+ * is a single memcpy:
+ *
+ *   static constexpr auto OP = erlpack::binary_fragment("op");
+ *   static constexpr auto READY = erlpack::concat(
+ *       erlpack::tuple_header_fragment<2>(), erlpack::atom_fragment("ready"));
+ *
+ *   erlpack::encode(b, OP);
+ *
+ * Fragments hold an encoded term, or part of one, without the version byte.
+ */
+namespace erlpack {
+
+template <size_t N>
+struct fragment {
+  std::array<uint8_t, N> bytes;
+
+  constexpr size_t size() const { return N; }
+  const char *data() const { return reinterpret_cast<const char *>(bytes.data()); }
+};
+
+namespace detail {
+
+template <size_t N>
+constexpr void store_be(fragment<N> &f, size_t offset, uint64_t value,
+                        size_t width) {
+  for (size_t i = 0; i < width; ++i)
+    f.bytes[offset + i] = static_cast<uint8_t>(value >> (8 * (width - 1 - i)));
+}
+
+constexpr size_t magnitude_bytes(unsigned long long value) {
+  size_t n = 0;
+  for (; value > 0; value >>= 8)
+    n++;
+  return n;
+}
+
+constexpr unsigned long long magnitude(long long value) {
+  return value < 0 ? 0ULL - static_cast<unsigned long long>(value)
+                   : static_cast<unsigned long long>(value);
+}
+
+template <uint8_t Tag, size_t N>
+constexpr fragment<N + 4> sized_fragment(const char (&bytes)[N]) {
+  fragment<N + 4> f{};
+  f.bytes[0] = Tag;
+  store_be(f, 1, N - 1, 4);
+  for (size_t i = 0; i + 1 < N; ++i)
+    f.bytes[5 + i] = static_cast<uint8_t>(bytes[i]);
+  return f;
+}
+
+} // namespace detail
+
+template <size_t... Ns>
+constexpr fragment<(Ns + ... + 0)> concat(const fragment<Ns> &...parts) {
+  fragment<(Ns + ... + 0)> f{};
+  size_t offset = 0;
+  (void)offset;
+  ((void)[&] {
+     for (size_t i = 0; i < Ns; ++i)
+       f.bytes[offset + i] = parts.bytes[i];
+     offset += Ns;
+   }(),
+   ...);
+  return f;
+}
+
+constexpr fragment<5> nil_fragment() {
+  return {{SMALL_ATOM_EXT, 3, 'n', 'i', 'l'}};
+}
+
+constexpr fragment<6> true_fragment() {
+  return {{SMALL_ATOM_EXT, 4, 't', 'r', 'u', 'e'}};
+}
+
+constexpr fragment<7> false_fragment() {
+  return {{SMALL_ATOM_EXT, 5, 'f', 'a', 'l', 's', 'e'}};
+}
+
+constexpr fragment<1> nil_ext_fragment() { return {{NIL_EXT}}; }
+
+// Same term as erlpack::atom, so only names that fit SMALL_ATOM_UTF8_EXT.
+template <size_t N>
+constexpr fragment<N + 1> atom_fragment(const char (&name)[N]) {
+  static_assert(N - 1 < 255, "atom_fragment only builds small atoms");
+  fragment<N + 1> f{};
+  f.bytes[0] = SMALL_ATOM_UTF8_EXT;
+  f.bytes[1] = static_cast<uint8_t>(N - 1);
+  for (size_t i = 0; i + 1 < N; ++i)
+    f.bytes[2 + i] = static_cast<uint8_t>(name[i]);
+  return f;
+}
+
+template <size_t N>
+constexpr fragment<N + 4> binary_fragment(const char (&bytes)[N]) {
+  return detail::sized_fragment<BINARY_EXT>(bytes);
+}
+
+// The same term erlpack::encode picks for an integer of that value.
+template <long long V>
+constexpr auto integer_fragment() {
+  if constexpr (V >= 0 && V <= 255) {
+    return fragment<2>{{SMALL_INTEGER_EXT, static_cast<uint8_t>(V)}};
+  } else if constexpr (V >= std::numeric_limits<int32_t>::min() &&
+                       V <= std::numeric_limits<int32_t>::max()) {
+    fragment<5> f{};
+    f.bytes[0] = INTEGER_EXT;
+    detail::store_be(f, 1, static_cast<uint32_t>(V), 4);
+    return f;
+  } else {
+    constexpr size_t n = detail::magnitude_bytes(detail::magnitude(V));
+    fragment<3 + n> f{};
+    f.bytes[0] = SMALL_BIG_EXT;
+    f.bytes[1] = static_cast<uint8_t>(n);
+    f.bytes[2] = V < 0 ? 1 : 0;
+    for (size_t i = 0; i < n; ++i)
+      f.bytes[3 + i] = static_cast<uint8_t>(detail::magnitude(V) >> (8 * i));
+    return f;
+  }
+}
+
+template <size_t Arity>
+constexpr auto tuple_header_fragment() {
+  if constexpr (Arity < 256) {
+    return fragment<2>{{SMALL_TUPLE_EXT, static_cast<uint8_t>(Arity)}};
+  } else {
+    static_assert(Arity <= 0xFFFFFFFF, "tuple is too large");
+    fragment<5> f{};
+    f.bytes[0] = LARGE_TUPLE_EXT;
+    detail::store_be(f, 1, Arity, 4);
+    return f;
+  }
+}
+
+template <size_t Length>
+constexpr fragment<5> list_header_fragment() {
+  static_assert(Length > 0 && Length <= 0xFFFFFFFF,
+                "lists hold 1 to 2^32 - 1 elements, use nil_ext_fragment for []");
+  fragment<5> f{};
+  f.bytes[0] = LIST_EXT;
+  detail::store_be(f, 1, Length, 4);
+  return f;
+}
+
+template <size_t Arity>
+constexpr fragment<5> map_header_fragment() {
+  static_assert(Arity <= 0xFFFFFFFF, "map is too large");
+  fragment<5> f{};
+  f.bytes[0] = MAP_EXT;
+  detail::store_be(f, 1, Arity, 4);
+  return f;
+}
+
+template <size_t N>
+struct encoder<fragment<N>> {
+  static int encode(erlpack_buffer *b, const fragment<N> &value) {
+    return erlpack_buffer_write(b, value.data(), N);
+  }
+};
+
+} // namespace erlpack
+
+#endif /* ERLPACK_FRAGMENT_H__ */
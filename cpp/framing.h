@@ -0,0 +1,117 @@
+#ifndef ERLPACK_FRAMING_H__
+#define ERLPACK_FRAMING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Splits a byte stream into the frames of Erlang's {packet, N} option:
+ * each frame is prefixed with its length as an N byte big-endian integer,
+ * N being 1, 2 or 4. Chunks are appended with erlpack_frames_feed as they
+ * arrive and complete frames are taken out with erlpack_frames_next.
+ *
+ * The pending bytes stay contiguous so a frame can be decoded in place.
+ * Consumed space at the front is reclaimed by moving the remainder down
+ * when a chunk would not fit behind it, so the buffer only grows to the
+ * largest amount of data that was ever pending at once.
+ */
+typedef struct erlpack_frames {
+  uint8_t *buf;
+  size_t start;
+  size_t end;
+  size_t allocated_size;
+  int packet;
+} erlpack_frames;
+
+static inline int erlpack_frames_init(erlpack_frames *f, int packet) {
+  f->buf = NULL;
+  f->start = 0;
+  f->end = 0;
+  f->allocated_size = 0;
+  f->packet = packet;
+  return packet == 1 || packet == 2 || packet == 4 ? 0 : -1;
+}
+
+static inline void erlpack_frames_free(erlpack_frames *f) {
+  free(f->buf);
+  f->buf = NULL;
+  f->start = 0;
+  f->end = 0;
+  f->allocated_size = 0;
+}
+
+// Bytes fed but not yet returned as part of a frame.
+static inline size_t erlpack_frames_pending(const erlpack_frames *f) {
+  return f->end - f->start;
+}
+
+// Appends a chunk of the stream. Returns -1 when the buffer cannot grow.
+static inline int erlpack_frames_feed(erlpack_frames *f, const void *data,
+                                      size_t length) {
+  if (length > f->allocated_size - f->end) {
+    const size_t pending = f->end - f->start;
+    if (f->start > 0) {
+      memmove(f->buf, f->buf + f->start, pending);
+      f->start = 0;
+      f->end = pending;
+    }
+
+    if (length > f->allocated_size - pending) {
+      size_t allocated_size = (pending + length) * 2;
+      uint8_t *buf = (uint8_t *)realloc(f->buf, allocated_size);
+      if (!buf)
+        return -1;
+
+      f->buf = buf;
+      f->allocated_size = allocated_size;
+    }
+  }
+
+  memcpy(f->buf + f->end, data, length);
+  f->end += length;
+  return 0;
+}
+
+/*
+ * Takes the next complete frame out of the buffer. Returns 1 and points
+ * `frame` at its payload, which stays valid until the next call to
+ * erlpack_frames_feed, or returns 0 when the frame is still incomplete.
+ */
+static inline int erlpack_frames_next(erlpack_frames *f, const uint8_t **frame,
+                                      size_t *length) {
+  const size_t pending = f->end - f->start;
+  const size_t header = (size_t)f->packet;
+  if (pending < header)
+    return 0;
+
+  const uint8_t *p = f->buf + f->start;
+  size_t size = 0;
+  for (size_t i = 0; i < header; ++i)
+    size = (size << 8) | p[i];
+
+  if (pending - header < size)
+    return 0;
+
+  *frame = p + header;
+  *length = size;
+  f->start += header + size;
+  if (f->start == f->end) {
+    // Nothing is left, so the next chunk starts at the front again. The
+    // frame just returned is not touched until then.
+    f->start = 0;
+    f->end = 0;
+  }
+  return 1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ERLPACK_FRAMING_H__ */
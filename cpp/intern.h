@@ -0,0 +1,146 @@
+#ifndef ERLPACK_INTERN_H__
+#define ERLPACK_INTERN_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Decoded values keyed by the bytes they were decoded from, so a decoder can
+ * hand out the same object every time the same atom (or other short term)
+ * comes up instead of building a new one. `kind` tells apart values decoded
+ * differently from the same bytes, such as latin-1 and utf-8 atoms.
+ *
+ * The table is direct-mapped: each key has a single slot and storing a key
+ * evicts whatever was there, so it stays at `capacity` entries no matter how
+ * many distinct keys go through it. Values are opaque to the table; the
+ * binding keeps a reference for each stored value and drops the one it gets
+ * back as evicted, and drops the rest through erlpack_intern_table_free.
+ */
+typedef struct erlpack_intern_entry {
+  void *value; // NULL when the slot is empty
+  char *bytes;
+  size_t length;
+  size_t allocated_size;
+  uint64_t hash;
+  int kind;
+} erlpack_intern_entry;
+
+typedef struct erlpack_intern_table {
+  erlpack_intern_entry *entries;
+  size_t capacity; // a power of 2, or 0 when the table is disabled
+} erlpack_intern_table;
+
+// `capacity` is rounded up to a power of 2; 0 disables the table.
+static inline int erlpack_intern_table_init(erlpack_intern_table *t,
+                                            size_t capacity) {
+  t->entries = NULL;
+  t->capacity = 0;
+  if (capacity == 0)
+    return 0;
+
+  size_t rounded = 1;
+  while (rounded < capacity)
+    rounded <<= 1;
+
+  t->entries =
+      (erlpack_intern_entry *)calloc(rounded, sizeof(erlpack_intern_entry));
+  if (!t->entries)
+    return -1;
+
+  t->capacity = rounded;
+  return 0;
+}
+
+// Calls `release` on every value still stored, then frees the table.
+static inline void erlpack_intern_table_free(erlpack_intern_table *t,
+                                             void (*release)(void *value)) {
+  for (size_t i = 0; i < t->capacity; ++i) {
+    erlpack_intern_entry *entry = &t->entries[i];
+    if (entry->value && release)
+      release(entry->value);
+    free(entry->bytes);
+  }
+
+  free(t->entries);
+  t->entries = NULL;
+  t->capacity = 0;
+}
+
+static inline uint64_t erlpack_intern_hash(int kind, const char *bytes,
+                                           size_t length) {
+  // FNV-1a, which is plenty for keys this short.
+  uint64_t hash = 0xCBF29CE484222325ULL ^ (uint64_t)kind;
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= (uint8_t)bytes[i];
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+static inline erlpack_intern_entry *
+erlpack_intern_slot(const erlpack_intern_table *t, uint64_t hash) {
+  return &t->entries[(size_t)(hash ^ (hash >> 32)) & (t->capacity - 1)];
+}
+
+// Returns the value stored for the key, or NULL.
+static inline void *erlpack_intern_table_find(const erlpack_intern_table *t,
+                                              int kind, const char *bytes,
+                                              size_t length) {
+  if (t->capacity == 0)
+    return NULL;
+
+  const uint64_t hash = erlpack_intern_hash(kind, bytes, length);
+  const erlpack_intern_entry *entry = erlpack_intern_slot(t, hash);
+  if (entry->value && entry->hash == hash && entry->kind == kind &&
+      entry->length == length &&
+      (length == 0 || memcmp(entry->bytes, bytes, length) == 0))
+    return entry->value;
+
+  return NULL;
+}
+
+/*
+ * Stores `value` for the key. Returns the value it evicted, which the
+ * caller now owns, or NULL. When the key cannot be stored (the table is
+ * disabled or memory ran out) `value` itself is returned, so the caller
+ * releases its reference either way.
+ */
+static inline void *erlpack_intern_table_store(erlpack_intern_table *t,
+                                               int kind, const char *bytes,
+                                               size_t length, void *value) {
+  if (t->capacity == 0)
+    return value;
+
+  const uint64_t hash = erlpack_intern_hash(kind, bytes, length);
+  erlpack_intern_entry *entry = erlpack_intern_slot(t, hash);
+
+  if (length > entry->allocated_size) {
+    char *stored = (char *)realloc(entry->bytes, length);
+    if (!stored)
+      return value;
+
+    entry->bytes = stored;
+    entry->allocated_size = length;
+  }
+
+  void *evicted = entry->value;
+  if (length > 0)
+    memcpy(entry->bytes, bytes, length);
+  entry->length = length;
+  entry->hash = hash;
+  entry->kind = kind;
+  entry->value = value;
+  return evicted;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ERLPACK_INTERN_H__ */
@@ -0,0 +1,141 @@
+#ifndef ERLPACK_SEGMENTS_H__
+#define ERLPACK_SEGMENTS_H__
+
+#include "encoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Scatter-gather output. Binaries of at least `threshold` bytes are not
+ * copied into the buffer: only their BINARY_EXT header is written, and the
+ * payload is recorded as an external segment that follows the buffer
+ * contents written so far. The caller must keep the referenced bytes alive
+ * until the output has been consumed.
+ */
+typedef struct erlpack_segment {
+  size_t offset; // buffer length at the time the segment was recorded
+  const char *bytes;
+  size_t length;
+} erlpack_segment;
+
+typedef struct erlpack_segments {
+  erlpack_segment *items;
+  size_t count;
+  size_t capacity;
+  size_t threshold;
+} erlpack_segments;
+
+typedef struct erlpack_iovec {
+  const char *base;
+  size_t length;
+} erlpack_iovec;
+
+static inline void erlpack_segments_init(erlpack_segments *segs,
+                                         size_t threshold) {
+  segs->items = NULL;
+  segs->count = 0;
+  segs->capacity = 0;
+  segs->threshold = threshold;
+}
+
+static inline void erlpack_segments_free(erlpack_segments *segs) {
+  free(segs->items);
+  segs->items = NULL;
+  segs->count = 0;
+  segs->capacity = 0;
+}
+
+static inline int erlpack_segments_push(erlpack_segments *segs, size_t offset,
+                                        const char *bytes, size_t length) {
+  if (segs->count == segs->capacity) {
+    size_t capacity = segs->capacity ? segs->capacity * 2 : 8;
+    erlpack_segment *items = (erlpack_segment *)realloc(
+        segs->items, capacity * sizeof(erlpack_segment));
+
+    if (!items)
+      return -1;
+
+    segs->items = items;
+    segs->capacity = capacity;
+  }
+
+  erlpack_segment *seg = &segs->items[segs->count++];
+  seg->offset = offset;
+  seg->bytes = bytes;
+  seg->length = length;
+  return 0;
+}
+
+// Like erlpack_append_binary, but payloads of at least `segs->threshold`
+// bytes become external segments instead of being copied.
+static inline int erlpack_append_binary_ref(erlpack_buffer *b,
+                                            erlpack_segments *segs,
+                                            const char *bytes, size_t size) {
+  if (segs == NULL || size < segs->threshold) {
+    return erlpack_append_binary(b, bytes, size);
+  }
+
+  unsigned char buf[5];
+  buf[0] = BINARY_EXT;
+  _erlpack_store32(buf + 1, size);
+
+  int ret = erlpack_buffer_write(b, (const char *)buf, 5);
+  if (ret < 0)
+    return ret;
+
+  return erlpack_segments_push(segs, b->length, bytes, size);
+}
+
+// Total number of bytes the buffer and its segments encode to.
+static inline size_t erlpack_segments_total_length(const erlpack_buffer *b,
+                                                   const erlpack_segments *segs) {
+  size_t total = b->length;
+  for (size_t i = 0; i < segs->count; ++i)
+    total += segs->items[i].length;
+
+  return total;
+}
+
+// Upper bound on the number of entries `erlpack_segments_gather` fills in.
+static inline size_t erlpack_segments_max_iovecs(const erlpack_segments *segs) {
+  return segs->count * 2 + 1;
+}
+
+// Interleaves the buffer contents with the external segments, in output
+// order, into `out` (suitable for writev/sendmsg). Returns the entry count.
+static inline size_t erlpack_segments_gather(const erlpack_buffer *b,
+                                             const erlpack_segments *segs,
+                                             erlpack_iovec *out) {
+  size_t n = 0;
+  size_t start = 0;
+
+  for (size_t i = 0; i < segs->count; ++i) {
+    const erlpack_segment *seg = &segs->items[i];
+    if (seg->offset > start) {
+      out[n].base = b->buf + start;
+      out[n].length = seg->offset - start;
+      n++;
+    }
+
+    out[n].base = seg->bytes;
+    out[n].length = seg->length;
+    n++;
+    start = seg->offset;
+  }
+
+  if (b->length > start) {
+    out[n].base = b->buf + start;
+    out[n].length = b->length - start;
+    n++;
+  }
+
+  return n;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ERLPACK_SEGMENTS_H__ */
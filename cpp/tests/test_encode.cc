@@ -0,0 +1,97 @@
+// Checks the terms erlpack::encode picks against their known encodings.
+#include <cstdio>
+#include <map>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <variant>
+#include <vector>
+#include "../encode.h"
+
+struct Point {
+  int x;
+  int y;
+};
+
+template <>
+struct erlpack::encoder<Point> {
+  static int encode(erlpack_buffer *b, const Point &p) {
+    return erlpack::encode(b, std::tie(p.x, p.y));
+  }
+};
+
+static int failures = 0;
+
+template <typename T>
+static void check(int line, const T &value, const std::string &expected) {
+  erlpack_buffer b;
+  erlpack_buffer_init(&b, NULL, 16);
+  const int ret = erlpack::encode(&b, value);
+  const std::string actual(b.buf, b.length);
+  erlpack_buffer_free(&b);
+
+  if (ret != 0 || actual != expected) {
+    std::fprintf(stderr, "line %d: encode returned %d,", line, ret);
+    for (unsigned char c : actual)
+      std::fprintf(stderr, " %02x", c);
+    std::fprintf(stderr, "\n");
+    failures++;
+  }
+}
+
+#define CHECK(value, expected) check(__LINE__, value, std::string(expected, sizeof(expected) - 1))
+
+int main() {
+  CHECK(true, "s\x04true");
+  CHECK(false, "s\x05" "false");
+  CHECK(nullptr, "s\x03nil");
+  CHECK(std::nullopt, "s\x03nil");
+
+  CHECK(0, "a\x00");
+  CHECK(static_cast<unsigned char>(255), "a\xff");
+  CHECK(256, "b\x00\x00\x01\x00");
+  CHECK(-1, "b\xff\xff\xff\xff");
+  CHECK(static_cast<short>(-300), "b\xff\xff\xfe\xd4");
+  CHECK(2147483647LL, "b\x7f\xff\xff\xff");
+  CHECK(2147483648LL, "n\x04\x00\x00\x00\x00\x80");
+  CHECK(-2147483649LL, "n\x04\x01\x01\x00\x00\x80");
+  CHECK(3000000000U, "n\x04\x00\x00\x5e\xd0\xb2");
+  CHECK(18446744073709551615ULL, "n\x08\x00\xff\xff\xff\xff\xff\xff\xff\xff");
+#ifdef __SIZEOF_INT128__
+  CHECK(static_cast<erlpack::detail::int128>(7), "a\x07");
+  CHECK(static_cast<erlpack::detail::int128>(1) << 64, "n\x09\x00\x00\x00\x00\x00\x00\x00\x00\x00\x01");
+  CHECK(-(static_cast<erlpack::detail::int128>(1) << 64), "n\x09\x01\x00\x00\x00\x00\x00\x00\x00\x00\x01");
+  CHECK(~static_cast<erlpack::detail::uint128>(0),
+        "n\x10\x00\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff");
+#endif
+
+  CHECK(1.5, "F\x3f\xf8\x00\x00\x00\x00\x00\x00");
+  CHECK(1.5f, "F\x3f\xf8\x00\x00\x00\x00\x00\x00");
+
+  CHECK("abc", "m\x00\x00\x00\x03" "abc");
+  CHECK(std::string("abc"), "m\x00\x00\x00\x03" "abc");
+  CHECK(std::string_view(""), "m\x00\x00\x00\x00");
+  CHECK(erlpack::atom("ok"), "w\x02ok");
+
+  CHECK(std::optional<int>(), "s\x03nil");
+  CHECK(std::optional<int>(1), "a\x01");
+  CHECK((std::variant<int, std::string>(std::string("x"))), "m\x00\x00\x00\x01x");
+
+  CHECK(std::vector<int>(), "j");
+  CHECK((std::vector<int>{1, 2}), "l\x00\x00\x00\x02" "a\x01" "a\x02" "j");
+  CHECK((std::map<std::string, int>{{"a", 1}}), "t\x00\x00\x00\x01" "m\x00\x00\x00\x01" "a" "a\x01");
+  CHECK(std::make_pair(1, erlpack::atom("x")), "h\x02" "a\x01" "w\x01x");
+  CHECK(std::make_tuple(), "h\x00");
+  CHECK((Point{1, 2}), "h\x02" "a\x01" "a\x02");
+
+  erlpack_buffer b;
+  erlpack_buffer_init(&b, NULL, 16);
+  const int ret = erlpack::encode_term(&b, erlpack::atom("ok"));
+  if (ret != 0 || std::string(b.buf, b.length) != std::string("\x83w\x02ok", 5)) {
+    std::fprintf(stderr, "encode_term did not prefix the version byte\n");
+    failures++;
+  }
+  erlpack_buffer_free(&b);
+
+  return failures == 0 ? 0 : 1;
+}
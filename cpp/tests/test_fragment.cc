@@ -0,0 +1,52 @@
+// Fragments are built at compile time, so their bytes are checked with
+// static_assert, and once more against erlpack::encode at run time.
+#include <cstdio>
+#include <string>
+#include "../fragment.h"
+
+template <size_t N, size_t M>
+constexpr bool equals(const erlpack::fragment<N> &f, const char (&expected)[M]) {
+  if (N != M - 1)
+    return false;
+  for (size_t i = 0; i < N; ++i)
+    if (f.bytes[i] != static_cast<uint8_t>(expected[i]))
+      return false;
+  return true;
+}
+
+static_assert(equals(erlpack::nil_fragment(), "s\x03nil"));
+static_assert(equals(erlpack::true_fragment(), "s\x04true"));
+static_assert(equals(erlpack::false_fragment(), "s\x05" "false"));
+static_assert(equals(erlpack::nil_ext_fragment(), "j"));
+static_assert(equals(erlpack::atom_fragment("ok"), "w\x02ok"));
+static_assert(equals(erlpack::binary_fragment("op"), "m\x00\x00\x00\x02op"));
+static_assert(equals(erlpack::integer_fragment<7>(), "a\x07"));
+static_assert(equals(erlpack::integer_fragment<-1>(), "b\xff\xff\xff\xff"));
+static_assert(equals(erlpack::integer_fragment<2147483648LL>(), "n\x04\x00\x00\x00\x00\x80"));
+static_assert(equals(erlpack::integer_fragment<-2147483649LL>(), "n\x04\x01\x01\x00\x00\x80"));
+static_assert(equals(erlpack::tuple_header_fragment<2>(), "h\x02"));
+static_assert(equals(erlpack::tuple_header_fragment<256>(), "i\x00\x00\x01\x00"));
+static_assert(equals(erlpack::list_header_fragment<3>(), "l\x00\x00\x00\x03"));
+static_assert(equals(erlpack::map_header_fragment<1>(), "t\x00\x00\x00\x01"));
+
+static constexpr auto READY = erlpack::concat(erlpack::tuple_header_fragment<2>(),
+                                              erlpack::atom_fragment("ready"),
+                                              erlpack::integer_fragment<1>());
+static_assert(READY.size() == 11);
+static_assert(equals(READY, "h\x02w\x05readya\x01"));
+static_assert(equals(erlpack::concat(), ""));
+
+int main() {
+  erlpack_buffer b;
+  erlpack_buffer_init(&b, NULL, 16);
+  const int ret = erlpack::encode(&b, std::make_tuple(erlpack::binary_fragment("op"), READY));
+  const std::string actual(b.buf, b.length);
+  erlpack_buffer_free(&b);
+
+  const std::string expected("h\x02m\x00\x00\x00\x02oph\x02w\x05readya\x01", 20);
+  if (ret != 0 || actual != expected) {
+    std::fprintf(stderr, "encoding fragments returned %d and %zu bytes\n", ret, actual.size());
+    return 1;
+  }
+  return 0;
+}
@@ -17,6 +17,7 @@ public:
         pk.buf = (char*)malloc(INITIAL_BUFFER_SIZE);
         pk.length = 0;
         pk.allocated_size = INITIAL_BUFFER_SIZE;
+        pk.allocator = NULL;
 
         ret = erlpack_append_version(&pk);
         if (ret == -1) {
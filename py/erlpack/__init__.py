@@ -1,11 +1,17 @@
-from ._packer import ErlangTermEncoder
-from ._unpacker import ErlangTermDecoder
-from .types import Atom, Export, PID, Port, Reference
+from ._packer import EncoderPool, ErlangTermEncoder, Fragment
+from ._unpacker import DecoderPool, ErlangTermDecoder, LazyList, LazyMap, Unpacker
+from .types import Atom, Export, MapStream, PID, Port, Reference
 
-encoder = ErlangTermEncoder()
+# Each thread packs and unpacks with its own encoder and decoder, so the module-level functions can be called
+# from any number of threads at once.
+encoder = EncoderPool()
 pack = encoder.pack
+pack_into = encoder.pack_into
+register_schema = encoder.register_schema
 
-decoder = ErlangTermDecoder()
+decoder = DecoderPool()
 unpack = decoder.loads
+iter_unpack = decoder.iter_unpack
+unpack_lazy = decoder.loads_lazy
 
-__all__ = ['pack', 'unpack', 'Atom', 'Export', 'PID', 'Port', 'Reference', 'ErlangTermEncoder']
+__all__ = ['pack', 'pack_into', 'register_schema', 'unpack', 'iter_unpack', 'unpack_lazy', 'Atom', 'Export', 'Fragment', 'LazyList', 'LazyMap', 'MapStream', 'PID', 'Port', 'Reference', 'DecoderPool', 'EncoderPool', 'ErlangTermDecoder', 'ErlangTermEncoder', 'Unpacker']
@@ -1,23 +1,70 @@
 #coding: utf-8
-#cython: embedsignature=True
+#cython: embedsignature=True, freethreading_compatible=True
 
+cimport cython
 from cpython cimport *
 from libc.stdlib cimport malloc, free
 from libc.string cimport *
 from libc.limits cimport *
 from libc.stdint cimport *
-from erlpack.types import Atom
+from erlpack.types import Atom, MapStream
+from sys import intern
+import threading
+import weakref
 
 cdef int DEFAULT_RECURSE_LIMIT = 256
-cdef size_t BIG_BUF_SIZE = 1024 * 1024 * 2
+cdef size_t DEFAULT_MAX_BUFFER_SIZE = 1024 * 1024 * 2
 cdef size_t INITIAL_BUFFER_SIZE = 1024 * 1024
 cdef size_t MAX_SIZE = (2 ** 32) - 1;
+cdef size_t DEFAULT_SEGMENT_THRESHOLD = 4096
+cdef size_t DEFAULT_ATOM_CACHE_SIZE = 1024
+
+# Returned by `_size` for terms whose encoded size cannot be known without encoding them, such as objects that
+# go through a hook.
+cdef Py_ssize_t UNKNOWN_SIZE = -2
+
+# How `_pack` encodes a value, resolved once per type by `_kind_of`.
+cdef enum:
+    PACK_INT
+    PACK_FLOAT
+    PACK_UNICODE
+    PACK_FRAGMENT
+    PACK_ATOM
+    PACK_BYTES
+    PACK_TUPLE
+    PACK_LIST
+    PACK_DICT
+    PACK_DICT_SUBCLASS
+    PACK_ERLPACK
+    PACK_MAP_STREAM
+    PACK_ITER
+    PACK_HOOK
+    PACK_SCHEMA
+
+# How a schema reads each field of an instance.
+cdef enum:
+    FIELD_ATTR   # getattr
+    FIELD_SLOT   # straight from a __slots__ member at `offset`
+    FIELD_INDEX  # item `offset` of a namedtuple
+
+# Types past this many are resolved every time instead of being cached, so classes created on the fly do not
+# grow an encoder's cache without bound.
+cdef Py_ssize_t MAX_CACHED_TYPES = 256
 
 cdef extern from "../../cpp/encoder.h":
+    struct erlpack_allocator:
+        pass
+
     struct erlpack_buffer:
         char*buf
         size_t length
         size_t allocated_size
+        const erlpack_allocator *allocator
+
+    int erlpack_buffer_init(erlpack_buffer *pk, const erlpack_allocator *allocator, size_t initial_size)
+    void erlpack_buffer_free(erlpack_buffer *pk)
+    int erlpack_buffer_reserve(erlpack_buffer *pk, size_t l)
+    int erlpack_buffer_write(erlpack_buffer *pk, const char *bytes, size_t l)
 
     int erlpack_append_int(erlpack_buffer *pk, int d)
     int erlpack_append_nil(erlpack_buffer *pk)
@@ -28,6 +75,7 @@ cdef extern from "../../cpp/encoder.h":
     int erlpack_append_integer(erlpack_buffer *pk, int32_t d)
     int erlpack_append_unsigned_long_long(erlpack_buffer *pk, unsigned long long d)
     int erlpack_append_long_long(erlpack_buffer *pk, long long d)
+    int erlpack_append_big_header(erlpack_buffer *pk, size_t size, int sign)
     int erlpack_append_double(erlpack_buffer *pk, double f)
     int erlpack_append_atom(erlpack_buffer *pk, const char *bytes, unsigned int size)
     int erlpack_append_atom_utf8(erlpack_buffer *pk, const char *bytes, unsigned int size)
@@ -37,23 +85,299 @@ cdef extern from "../../cpp/encoder.h":
     int erlpack_append_nil_ext(erlpack_buffer *pk)
     int erlpack_append_list_header(erlpack_buffer *pk, size_t size)
     int erlpack_append_map_header(erlpack_buffer *pk, size_t size)
+    void erlpack_patch_header_size(erlpack_buffer *pk, size_t offset, size_t size)
+
+    size_t erlpack_sizeof_version()
+    size_t erlpack_sizeof_nil()
+    size_t erlpack_sizeof_false()
+    size_t erlpack_sizeof_true()
+    size_t erlpack_sizeof_small_integer()
+    size_t erlpack_sizeof_integer()
+    size_t erlpack_sizeof_unsigned_long_long(unsigned long long d)
+    size_t erlpack_sizeof_long_long(long long d)
+    size_t erlpack_sizeof_big(size_t size)
+    size_t erlpack_sizeof_double()
+    size_t erlpack_sizeof_atom(size_t size)
+    size_t erlpack_sizeof_binary(size_t size)
+    size_t erlpack_sizeof_string(size_t size)
+    size_t erlpack_sizeof_tuple_header(size_t size)
+    size_t erlpack_sizeof_nil_ext()
+    size_t erlpack_sizeof_list_header()
+    size_t erlpack_sizeof_map_header()
+
+cdef extern from "../../cpp/allocator.h":
+    const erlpack_allocator erlpack_pool_allocator
+
+    void erlpack_buffer_init_fixed(erlpack_buffer *pk, char *buf, size_t size)
+
+cdef extern from "../../cpp/segments.h":
+    struct erlpack_segment:
+        size_t offset
+        const char *bytes
+        size_t length
+
+    struct erlpack_segments:
+        erlpack_segment *items
+        size_t count
+        size_t threshold
+
+    void erlpack_segments_init(erlpack_segments *segs, size_t threshold)
+    void erlpack_segments_free(erlpack_segments *segs)
+    int erlpack_append_binary_ref(erlpack_buffer *pk, erlpack_segments *segs, const char *bytes, size_t size)
+
+cdef extern from "../../cpp/compress.h":
+    struct erlpack_compressor:
+        int level
+
+    int ERLPACK_DEFAULT_COMPRESS_LEVEL
+    int ERLPACK_DEFAULT_COMPRESS_THRESHOLD
+
+    void erlpack_compressor_init(erlpack_compressor *c, int level)
+    void erlpack_compressor_free(erlpack_compressor *c)
+    int erlpack_compress_level_valid(int level)
+    int erlpack_compress_term(erlpack_compressor *c, const char *term, size_t length, erlpack_buffer *out)
+
+cdef extern from "../../cpp/atoms.h":
+    struct erlpack_atom_entry:
+        size_t length
+
+    struct erlpack_atom_table:
+        size_t capacity
+
+    int erlpack_atom_table_init(erlpack_atom_table *t, size_t capacity)
+    void erlpack_atom_table_free(erlpack_atom_table *t)
+    const erlpack_atom_entry *erlpack_atom_table_find(const erlpack_atom_table *t, const char *bytes, size_t size,
+                                                      int utf8)
+    const erlpack_atom_entry *erlpack_atom_table_add(erlpack_atom_table *t, const char *bytes, size_t size, int utf8)
+    int erlpack_append_encoded_atom(erlpack_buffer *pk, const erlpack_atom_entry *entry)
+
+cdef extern from *:
+    """
+    static unsigned int erlpack_type_version(PyObject *type) {
+        return ((PyTypeObject *)type)->tp_version_tag;
+    }
+    """
+    # Changes whenever the type or one of its bases is modified, 0 when CPython stopped tracking it.
+    unsigned int erlpack_type_version(object type)
+
+cdef extern from *:
+    """
+    #include <structmember.h>
+
+    // The offset of the object a __slots__ member descriptor reads, or -1 for any other attribute.
+    static Py_ssize_t erlpack_slot_offset(PyObject *descr) {
+        if (Py_TYPE(descr) != &PyMemberDescr_Type)
+            return -1;
+
+        PyMemberDef *member = ((PyMemberDescrObject *)descr)->d_member;
+        return member->type == T_OBJECT_EX ? member->offset : -1;
+    }
+
+    // Borrowed, NULL when the slot is not set.
+    static PyObject *erlpack_read_slot(PyObject *o, Py_ssize_t offset) {
+        return *(PyObject **)((char *)o + offset);
+    }
+    """
+    Py_ssize_t erlpack_slot_offset(object descr)
+    PyObject *erlpack_read_slot(object o, Py_ssize_t offset)
+
+cdef extern from *:
+    """
+    // Writes the magnitude of a non-negative int as `n` little-endian bytes. _PyLong_AsByteArray grew a
+    // `with_exceptions` argument in 3.13.
+    static int erlpack_long_magnitude(PyObject *v, unsigned char *bytes, size_t n) {
+    #if PY_VERSION_HEX >= 0x030D0000
+        return _PyLong_AsByteArray((PyLongObject *)v, bytes, n, 1, 0, 1);
+    #else
+        return _PyLong_AsByteArray((PyLongObject *)v, bytes, n, 1, 0);
+    #endif
+    }
+    """
+    int erlpack_long_magnitude(object v, unsigned char *bytes, size_t n) except -1
+    size_t _PyLong_NumBits(object v) except? <size_t> -1
 
 class EncodingError(Exception):
     pass
 
 
+cdef class Fragment
+
+
+cdef inline int _exact_kind(object o) noexcept:
+    """The PACK_* kind of the builtin types that make up most terms, without a lookup, or -1 for other types."""
+    if PyUnicode_CheckExact(o):
+        return PACK_UNICODE
+    elif PyLong_CheckExact(o):
+        return PACK_INT
+    elif PyDict_CheckExact(o):
+        return PACK_DICT
+    elif PyList_CheckExact(o):
+        return PACK_LIST
+    elif PyTuple_CheckExact(o):
+        return PACK_TUPLE
+    elif PyFloat_CheckExact(o):
+        return PACK_FLOAT
+    elif PyBytes_CheckExact(o):
+        return PACK_BYTES
+    return -1
+
+
+cdef int _resolve_kind(object o) except -1:
+    """The PACK_* kind of `o`. Checks that match builtin types go first, as they are by far the most common."""
+    if PyLong_Check(o):
+        return PACK_INT
+    elif PyFloat_Check(o):
+        return PACK_FLOAT
+    elif PyUnicode_CheckExact(o):
+        return PACK_UNICODE
+    elif isinstance(o, Fragment):
+        return PACK_FRAGMENT
+    elif PyObject_IsInstance(o, Atom):
+        return PACK_ATOM
+    elif PyBytes_Check(o):
+        return PACK_BYTES
+    elif PyUnicode_Check(o):
+        return PACK_UNICODE
+    elif PyTuple_Check(o):
+        return PACK_TUPLE
+    elif PyList_Check(o):
+        return PACK_LIST
+    elif PyDict_CheckExact(o):
+        return PACK_DICT
+    elif PyDict_Check(o):
+        return PACK_DICT_SUBCLASS
+    # Looked up on the type, like other special methods, so the answer holds for every instance.
+    elif PyObject_HasAttrString(type(o), '__erlpack__'):
+        return PACK_ERLPACK
+    elif PyObject_IsInstance(o, MapStream):
+        return PACK_MAP_STREAM
+    elif PyIter_Check(o):
+        return PACK_ITER
+    return PACK_HOOK
+
+
+cdef struct erlpack_schema_field:
+    int access
+    Py_ssize_t offset
+    PyObject *name       # borrowed from Schema.names
+    const char *key      # the encoded map key, borrowed from Schema.keys, or NULL for tuples
+    Py_ssize_t key_size
+
+
+cdef class Schema(object):
+    """
+    How instances of a class registered with `ErlangTermEncoder.register_schema` are packed: the container
+    header and tag, and for each field where to read it from and its map key, all worked out once.
+    """
+    cdef readonly object cls
+    cdef readonly tuple names
+    cdef bytes header
+    cdef list keys
+    cdef erlpack_schema_field *fields
+    cdef Py_ssize_t count
+
+    def __dealloc__(self):
+        free(self.fields)
+
+    cdef object read(self, object o, Py_ssize_t i):
+        cdef erlpack_schema_field *field = &self.fields[i]
+        cdef PyObject *value
+
+        if field.access == FIELD_INDEX:
+            if field.offset >= PyTuple_GET_SIZE(o):
+                raise AttributeError(<object> field.name)
+            return <object> PyTuple_GET_ITEM(o, field.offset)
+
+        elif field.access == FIELD_SLOT:
+            value = erlpack_read_slot(o, field.offset)
+            if value == NULL:
+                raise AttributeError(<object> field.name)
+            return <object> value
+
+        return getattr(o, <object> field.name)
+
+    def __repr__(self):
+        return 'Schema(%s, %r)' % (self.cls.__name__, self.names)
+
+
+cdef tuple _schema_fields(object cls):
+    """The fields of a dataclass, a namedtuple or a class with __slots__, in definition order."""
+    import dataclasses
+
+    if dataclasses.is_dataclass(cls):
+        return tuple(field.name for field in dataclasses.fields(cls))
+
+    if issubclass(cls, tuple) and hasattr(cls, '_fields'):
+        return tuple(cls._fields)
+
+    names = []
+    for base in reversed(cls.__mro__):
+        slots = base.__dict__.get('__slots__', ())
+        for name in ((slots,) if isinstance(slots, str) else slots):
+            if name in ('__dict__', '__weakref__'):
+                continue
+            if name.startswith('__') and not name.endswith('__'):
+                name = '_%s%s' % (base.__name__.lstrip('_'), name)
+            names.append(name)
+
+    if not names:
+        raise TypeError('The fields of %s cannot be inferred, pass them to register_schema' % cls.__name__)
+
+    return tuple(names)
+
+
 cdef class ErlangTermEncoder(object):
     cdef erlpack_buffer pk
     cdef char* _encoding
     cdef char* _unicode_errors
     cdef char* _unicode_type
+    cdef bool _utf8
+    cdef bool _binary_unicode
+    cdef bool _str_unicode
     cdef object _encode_hook
     cdef bool _in_use
+    cdef size_t _segment_threshold
+    cdef erlpack_segments _segments
+    cdef erlpack_segments *_segments_out
+    cdef list _segment_owners
+    cdef bool _compressed
+    cdef size_t _compress_threshold
+    cdef erlpack_compressor _compressor
+    cdef erlpack_atom_table _atoms
+    cdef size_t _max_buffer_size
+    cdef size_t _buffer_decay
+    cdef size_t _idle_packs
+    cdef bool _buf_used
+    cdef size_t _buf_allocations
+    cdef size_t _buf_reuses
+    cdef size_t _buf_releases
+    cdef size_t _direct_packs
+    cdef dict _kinds
+    cdef dict _schemas
+    cdef dict _schema_types
+    cdef Py_ssize_t _pool_schemas
+    cdef object __weakref__
 
     def __cinit__(self):
         self.pk.buf = NULL
-
-    def __init__(self, encoding=b'utf-8', unicode_errors=b'strict', unicode_type=b'binary', encode_hook=None):
+        self._segments_out = NULL
+        self._kinds = {}
+        self._schemas = {}
+        self._schema_types = {}
+        erlpack_compressor_init(&self._compressor, ERLPACK_DEFAULT_COMPRESS_LEVEL)
+        erlpack_atom_table_init(&self._atoms, 0)
+
+    def __init__(self, encoding=b'utf-8', unicode_errors=b'strict', unicode_type=b'binary', encode_hook=None,
+                 segment_threshold=DEFAULT_SEGMENT_THRESHOLD, compressed=False,
+                 compress_threshold=ERLPACK_DEFAULT_COMPRESS_THRESHOLD,
+                 compress_level=ERLPACK_DEFAULT_COMPRESS_LEVEL, atom_cache_size=DEFAULT_ATOM_CACHE_SIZE,
+                 max_buffer_size=DEFAULT_MAX_BUFFER_SIZE, buffer_decay=0):
+        """
+        The encoding buffer is kept between packs as long as it is smaller than `max_buffer_size` bytes, so
+        payloads that always need a large buffer should raise it. With a non-zero `buffer_decay`, a retained
+        buffer that grew past its initial size is also released after that many packs in a row used less than
+        a quarter of it, so one large payload does not pin memory for good.
+        """
         cdef object _encoding
         cdef object _unicode_errors
 
@@ -73,100 +397,497 @@ cdef class ErlangTermEncoder(object):
 
             self._encoding = PyBytes_AsString(_encoding)
             self._unicode_errors = PyBytes_AsString(_unicode_errors)
+            self._utf8 = _encoding.lower().replace(b'_', b'-') in (b'utf-8', b'utf8') and _unicode_errors == b'strict'
 
         self._unicode_type = unicode_type
+        self._binary_unicode = unicode_type == b'binary'
+        self._str_unicode = unicode_type == b'str'
         self._encode_hook = encode_hook
         self._in_use = False
+        self._segment_threshold = segment_threshold
+
+        if not erlpack_compress_level_valid(compress_level):
+            raise ValueError('compress_level must be between -1 and 9, got %r' % (compress_level,))
+
+        self._compressed = compressed
+        self._compress_threshold = compress_threshold
+        erlpack_compressor_free(&self._compressor)
+        erlpack_compressor_init(&self._compressor, compress_level)
+
+        erlpack_atom_table_free(&self._atoms)
+        if erlpack_atom_table_init(&self._atoms, atom_cache_size) < 0:
+            raise MemoryError
+
+        self._max_buffer_size = max_buffer_size
+        self._buffer_decay = buffer_decay
+        self._idle_packs = 0
+
+    cdef int _acquire(self) except -1:
+        """
+        Marks the encoder busy for the duration of a pack, raising RuntimeError if it already is. The check and
+        the update are one step, so two threads sharing an encoder without the GIL cannot both get in.
+        """
+        cdef bint busy
+        with cython.critical_section(self):
+            busy = self._in_use
+            self._in_use = True
+
+        if busy:
+            raise RuntimeError("Attempting to reuse an ErlangTermEncoder that is currently encoding something")
+        return 0
 
     cdef _ensure_buf(self):
         """
         Ensures that a buffer is available to be written to when serializing data.
 
-        If there is no buffer, allocate one sized to `INITIAL_BUFFER_SIZE`. If allocation
-        fails, raise a MemoryError.
+        If there is no buffer, take one of at least `INITIAL_BUFFER_SIZE` bytes from the thread-local
+        buffer pool. If allocation fails, raise a MemoryError.
         """
         if self.pk.buf != NULL:
             self.pk.length = 0
+            self._buf_reuses += 1
+
+        elif erlpack_buffer_init(&self.pk, &erlpack_pool_allocator, INITIAL_BUFFER_SIZE) == -1:
+            raise MemoryError('Unable to allocate buffer')
 
         else:
-            self.pk.buf = <char*> malloc(INITIAL_BUFFER_SIZE)
-            if self.pk.buf == NULL:
-                raise MemoryError('Unable to allocate buffer')
+            self._buf_allocations += 1
 
-            self.pk.allocated_size = INITIAL_BUFFER_SIZE
-            self.pk.length = 0
+        self._buf_used = True
 
-    cdef _free_big_buf(self):
+    cdef _release_buf(self):
         """
-        If the buffer is larger than `BIG_BUF_SIZE`, free it, so that packing large data does not hold onto
-        the big buffer after the serialization is complete.
+        Applies the retention policy once a pack is done with the buffer: a buffer of `max_buffer_size` bytes
+        or more is freed right away, and one that has been mostly idle for `buffer_decay` packs is freed too.
         """
-        if self.pk.allocated_size >= BIG_BUF_SIZE:
-            free(self.pk.buf)
-            self.pk.buf = NULL
-            self.pk.length = 0
-            self.pk.allocated_size = 0
+        if not self._buf_used or self.pk.buf == NULL:
+            return
+
+        self._buf_used = False
+        if self.pk.allocated_size >= self._max_buffer_size:
+            self._free_buf()
+
+        elif self._buffer_decay and self.pk.allocated_size > INITIAL_BUFFER_SIZE and \
+                self.pk.length < self.pk.allocated_size // 4:
+            self._idle_packs += 1
+            if self._idle_packs >= self._buffer_decay:
+                self._free_buf()
+
+        else:
+            self._idle_packs = 0
+
+    cdef _free_buf(self):
+        erlpack_buffer_free(&self.pk)
+        self._idle_packs = 0
+        self._buf_releases += 1
+
+    @property
+    def buffer_stats(self):
+        """
+        Counts of how packs got their buffer: `allocated` a new one, `reused` the retained one, and `released`
+        it afterwards under the retention policy. `retained` is the size of the buffer currently kept. Terms that
+        can be sized up front, whatever their size, are written straight into the bytes object or the buffer
+        they end up in and never need the retained buffer; `direct` counts those packs.
+        """
+        return {
+            'allocated': self._buf_allocations,
+            'reused': self._buf_reuses,
+            'released': self._buf_releases,
+            'direct': self._direct_packs,
+            'retained': self.pk.allocated_size if self.pk.buf != NULL else 0,
+        }
 
     def __dealloc__(self):
-        if self.pk.buf != NULL:
-            free(self.pk.buf)
+        erlpack_buffer_free(&self.pk)
+        erlpack_segments_free(&self._segments)
+        erlpack_compressor_free(&self._compressor)
+        erlpack_atom_table_free(&self._atoms)
+
+    cdef object _compress(self, const char *term, size_t length):
+        """
+        Returns the COMPRESSED envelope of an encoded term, or None if the term is below `compress_threshold` or
+        does not get any smaller, in which case it should be sent as is.
+        """
+        cdef erlpack_buffer out
+        cdef int ret
+
+        if not self._compressed or length - 1 < self._compress_threshold:
+            return None
+
+        if erlpack_buffer_init(&out, &erlpack_pool_allocator, length) == -1:
+            raise MemoryError('Unable to allocate buffer')
+
+        try:
+            ret = erlpack_compress_term(&self._compressor, term, length, &out)
+            if ret == -1:
+                raise MemoryError('Unable to compress term')
+            elif ret:
+                return None
+
+            return PyBytes_FromStringAndSize(out.buf, out.length)
+        finally:
+            erlpack_buffer_free(&out)
+
+    cdef int _append_binary(self, object owner, const char *bytes, size_t size) except? -1:
+        """
+        Appends a binary whose bytes are kept alive by `owner`. While packing segments, large binaries are
+        referenced rather than copied, and `owner` is held on to until the segments are handed out.
+        """
+        cdef int ret
+        if self._segments_out == NULL or size < self._segments_out.threshold:
+            return erlpack_append_binary(&self.pk, bytes, size)
+
+        ret = erlpack_append_binary_ref(&self.pk, self._segments_out, bytes, size)
+        if ret == 0:
+            self._segment_owners.append(owner)
+
+        return ret
+
+    cdef int _kind_of(self, object o) except -1:
+        """
+        Returns the PACK_* kind of `o`. Everything that decides it depends on the type alone, so it is cached per
+        type, along with the type's version so a class that is modified afterwards is resolved again.
+        """
+        cdef object t = type(o)
+        cdef PyObject *cached = PyDict_GetItem(self._kinds, t)
+        cdef unsigned long long entry
+        cdef unsigned int version
+
+        if cached != NULL:
+            entry = PyLong_AsUnsignedLongLong(<object> cached)
+            if entry >> 8 == erlpack_type_version(t):
+                return entry & 0xFF
+
+        kind = PACK_SCHEMA if self._schemas and self._schema_of(t) is not None else _resolve_kind(o)
+        version = erlpack_type_version(t)
+        if version != 0 and (cached != NULL or PyDict_Size(self._kinds) < MAX_CACHED_TYPES):
+            self._kinds[t] = (<unsigned long long> version << 8) | kind
+        return kind
+
+    cdef Schema _schema_of(self, object t):
+        """The schema registered for `t` or its nearest base that has one, or None."""
+        cdef PyObject *found = PyDict_GetItem(self._schema_types, t)
+        if found != NULL:
+            return <Schema> found
+
+        for base in t.__mro__:
+            schema = self._schemas.get(base)
+            if schema is not None:
+                self._schema_types[t] = schema
+                return schema
+
+        return None
+
+    def register_schema(self, cls, fields=None, as_='map', tag=None):
+        """
+        Packs instances of `cls` (and its subclasses) by reading their `fields` directly, instead of through
+        `__erlpack__` or the encode hook and the dict or tuple they would build. `fields` defaults to those of a
+        dataclass or namedtuple, or the `__slots__` of the class. Fields given as an `Atom` become atom keys.
+
+        With `as_='map'` an instance packs like a dict of its fields, and a `tag` is added under the atom key
+        `__struct__`, the way Elixir structs are. With `as_='tuple'` it packs as a tuple of the fields, preceded by
+        `tag` if there is one, which is how Erlang records look. Keys and the tag are encoded once, here.
+        """
+        cdef Schema schema = Schema.__new__(Schema)
+        cdef erlpack_buffer header
+        cdef erlpack_schema_field *field
+        cdef Py_ssize_t count
+        cdef Py_ssize_t i
+        cdef int ret
+
+        if not isinstance(cls, type):
+            raise TypeError('register_schema expects a class, got %r' % (cls,))
+        if cls in (str, int, float, bytes, bool, tuple, list, dict, type(None)):
+            raise TypeError('%s is always packed as the builtin it is' % cls.__name__)
+        if as_ not in ('map', 'tuple'):
+            raise ValueError("as_ must be 'map' or 'tuple', got %r" % (as_,))
+
+        schema.cls = cls
+        fields = tuple(fields) if fields is not None else _schema_fields(cls)
+        schema.names = tuple(intern(str(name)) for name in fields)
+        schema.count = len(schema.names)
+        count = schema.count + (tag is not None)
+        if <size_t> count > MAX_SIZE:
+            raise ValueError('Too many fields')
+
+        if erlpack_buffer_init(&header, NULL, 16) == -1:
+            raise MemoryError
+        try:
+            ret = erlpack_append_map_header(&header, count) if as_ == 'map' else \
+                erlpack_append_tuple_header(&header, count)
+            if ret == 0 and tag is not None:
+                key = self._freeze(Atom('__struct__')) if as_ == 'map' else b''
+                tag = self._freeze(tag)
+                ret = erlpack_buffer_write(&header, PyBytes_AS_STRING(key), PyBytes_GET_SIZE(key))
+                if ret == 0:
+                    ret = erlpack_buffer_write(&header, PyBytes_AS_STRING(tag), PyBytes_GET_SIZE(tag))
+            if ret != 0:
+                raise MemoryError
+            schema.header = PyBytes_FromStringAndSize(header.buf, header.length)
+        finally:
+            erlpack_buffer_free(&header)
+
+        schema.keys = [self._freeze(name) for name in fields] if as_ == 'map' else []
+
+        schema.fields = <erlpack_schema_field *> malloc(max(schema.count, 1) * sizeof(erlpack_schema_field))
+        if schema.fields == NULL:
+            raise MemoryError
+
+        named_tuple = issubclass(cls, tuple) and hasattr(cls, '_fields')
+        for i in range(schema.count):
+            name = schema.names[i]
+            field = &schema.fields[i]
+            field.name = <PyObject *> name
+            field.access = FIELD_ATTR
+            field.offset = 0
+            field.key = NULL
+            field.key_size = 0
+            if as_ == 'map':
+                field.key = PyBytes_AS_STRING(schema.keys[i])
+                field.key_size = PyBytes_GET_SIZE(schema.keys[i])
+
+            if named_tuple and name in cls._fields:
+                field.access = FIELD_INDEX
+                field.offset = cls._fields.index(name)
+                continue
+
+            for base in cls.__mro__:
+                if name in base.__dict__:
+                    offset = erlpack_slot_offset(base.__dict__[name])
+                    if offset >= 0:
+                        field.access = FIELD_SLOT
+                        field.offset = offset
+                    break
+
+        self._schemas[cls] = schema
+        self._schema_types.clear()
+        self._kinds.clear()
+        return schema
+
+    cdef int _pack_schema(self, Schema schema, object o, int nest_limit) except? -1:
+        cdef erlpack_schema_field *field
+        cdef Py_ssize_t i
+        cdef int ret = erlpack_buffer_write(&self.pk, PyBytes_AS_STRING(schema.header),
+                                            PyBytes_GET_SIZE(schema.header))
+
+        for i in range(schema.count):
+            if ret != 0:
+                return ret
+
+            field = &schema.fields[i]
+            if field.key != NULL:
+                ret = erlpack_buffer_write(&self.pk, field.key, field.key_size)
+                if ret != 0:
+                    return ret
+
+            ret = self._pack(schema.read(o, i), nest_limit - 1)
+
+        return ret
+
+    cdef Py_ssize_t _size(self, object o, int nest_limit) except -1:
+        """
+        Computes the exact number of bytes `_pack` writes for `o`, or `UNKNOWN_SIZE` if that cannot be known
+        up front. Anything `_pack` would reject is reported as `UNKNOWN_SIZE` too, and left to `_pack` to raise.
+        """
+        cdef Py_ssize_t size
+        cdef Py_ssize_t item_size
+        cdef Py_ssize_t length
+        cdef long long llval
+        cdef int overflow
+        cdef dict d
+        cdef int kind
+
+        if nest_limit < 0:
+            return UNKNOWN_SIZE
+
+        if o is None:
+            return erlpack_sizeof_nil()
+
+        elif o is True:
+            return erlpack_sizeof_true()
+
+        elif o is False:
+            return erlpack_sizeof_false()
+
+        kind = _exact_kind(o)
+        if kind < 0:
+            kind = self._kind_of(o)
+
+        if kind == PACK_INT:
+            llval = PyLong_AsLongLongAndOverflow(o, &overflow)
+            if overflow == 0:
+                if 0 <= llval <= 255:
+                    return erlpack_sizeof_small_integer()
+
+                elif -2147483648 <= llval <= 2147483647:
+                    return erlpack_sizeof_integer()
+
+                return erlpack_sizeof_long_long(llval)
+
+            length = (_PyLong_NumBits(o) + 7) // 8
+            if <size_t> length > MAX_SIZE:
+                return UNKNOWN_SIZE
+
+            return erlpack_sizeof_big(length)
+
+        elif kind == PACK_FLOAT:
+            return erlpack_sizeof_double()
+
+        elif kind == PACK_UNICODE:
+            return self._size_unicode(o)
+
+        elif kind == PACK_FRAGMENT:
+            return PyBytes_GET_SIZE((<Fragment> o).encoded)
+
+        elif kind == PACK_ATOM:
+            # Only atoms that are all latin-1 have one byte per character, the rest fail to encode.
+            if PyUnicode_KIND(o) != PyUnicode_1BYTE_KIND:
+                return UNKNOWN_SIZE
+
+            return erlpack_sizeof_atom(PyUnicode_GET_LENGTH(o))
+
+        elif kind == PACK_BYTES:
+            return erlpack_sizeof_binary(PyBytes_GET_SIZE(o))
+
+        elif kind == PACK_TUPLE:
+            length = PyTuple_GET_SIZE(o)
+            if <size_t> length > MAX_SIZE:
+                return UNKNOWN_SIZE
+
+            size = erlpack_sizeof_tuple_header(length)
+            for item in o:
+                item_size = self._size(item, nest_limit - 1)
+                if item_size == UNKNOWN_SIZE:
+                    return UNKNOWN_SIZE
+                size += item_size
+
+            return size
+
+        elif kind == PACK_LIST:
+            length = PyList_GET_SIZE(o)
+            if length == 0:
+                return erlpack_sizeof_nil_ext()
+
+            if <size_t> length > MAX_SIZE:
+                return UNKNOWN_SIZE
+
+            size = erlpack_sizeof_list_header() + erlpack_sizeof_nil_ext()
+            for item in o:
+                item_size = self._size(item, nest_limit - 1)
+                if item_size == UNKNOWN_SIZE:
+                    return UNKNOWN_SIZE
+                size += item_size
+
+            return size
+
+        elif kind == PACK_DICT:
+            d = <dict> o
+            length = PyDict_Size(d)
+            if <size_t> length > MAX_SIZE:
+                return UNKNOWN_SIZE
+
+            size = erlpack_sizeof_map_header()
+            for k, v in d.iteritems():
+                item_size = self._size(k, nest_limit - 1)
+                if item_size == UNKNOWN_SIZE:
+                    return UNKNOWN_SIZE
+                size += item_size
+
+                item_size = self._size(v, nest_limit - 1)
+                if item_size == UNKNOWN_SIZE:
+                    return UNKNOWN_SIZE
+                size += item_size
+
+            return size
 
-    cdef int _pack(self, object o, int nest_limit=DEFAULT_RECURSE_LIMIT) except -1:
+        # `__erlpack__`, the encode hook, a dict subclass's `items()` and the properties a schema reads may not
+        # return the same thing twice, and sizing them would run them twice, so objects needing them are only
+        # ever encoded once.
+        return UNKNOWN_SIZE
+
+    cdef Py_ssize_t _size_unicode(self, object o) except -1:
+        cdef Py_ssize_t length
+        if not self._utf8 or not self._binary_unicode:
+            return UNKNOWN_SIZE
+
+        PyUnicode_AsUTF8AndSize(o, &length)
+        if <size_t> length > MAX_SIZE:
+            return UNKNOWN_SIZE
+
+        return erlpack_sizeof_binary(length)
+
+    cdef int _pack(self, object o, int nest_limit=DEFAULT_RECURSE_LIMIT) except? -1:
+        """
+        Appends `o` to the buffer. Returns -1 without an exception set when the buffer cannot grow, which is also
+        how a fixed buffer reports that the term did not fit, so callers pass it up rather than treat it as raised.
+        """
         cdef int ret
         cdef long long llval
         cdef unsigned long long ullval
         cdef long longval
         cdef double doubleval
         cdef size_t sizeval
+        cdef int overflow
         cdef dict d
         cdef object obj
+        cdef int kind
 
         if nest_limit < 0:
             raise EncodingError('Exceeded recursion limit')
 
         if o is None:
-            ret = erlpack_append_nil(&self.pk)
+            return erlpack_append_nil(&self.pk)
 
         elif o is True:
-            ret = erlpack_append_true(&self.pk)
+            return erlpack_append_true(&self.pk)
 
         elif o is False:
-            ret = erlpack_append_false(&self.pk)
+            return erlpack_append_false(&self.pk)
 
-        elif PyLong_Check(o) or PyInt_Check(o):
-            if 0 <= o <= 255:
-                ret = erlpack_append_small_integer(&self.pk, <unsigned char> o)
+        kind = _exact_kind(o)
+        if kind < 0:
+            kind = self._kind_of(o)
 
-            elif -2147483648 <= o <= 2147483647:
-                ret = erlpack_append_integer(&self.pk, <int32_t> o)
+        if kind == PACK_INT:
+            llval = PyLong_AsLongLongAndOverflow(o, &overflow)
+            if overflow == 0:
+                if 0 <= llval <= 255:
+                    ret = erlpack_append_small_integer(&self.pk, <unsigned char> llval)
 
-            else:
-                if o > 0:
-                    ullval = o
-                    ret = erlpack_append_unsigned_long_long(&self.pk, ullval)
+                elif -2147483648 <= llval <= 2147483647:
+                    ret = erlpack_append_integer(&self.pk, <int32_t> llval)
+
+                elif llval > 0:
+                    ret = erlpack_append_unsigned_long_long(&self.pk, <unsigned long long> llval)
 
                 else:
-                    llval = o
                     ret = erlpack_append_long_long(&self.pk, llval)
 
-        elif PyFloat_Check(o):
+            elif overflow > 0 and _PyLong_NumBits(o) <= 64:
+                ullval = o
+                ret = erlpack_append_unsigned_long_long(&self.pk, ullval)
+
+            else:
+                ret = self._encode_big(o)
+
+        elif kind == PACK_FLOAT:
             doubleval = o
             ret = erlpack_append_double(&self.pk, doubleval)
 
-        elif PyObject_IsInstance(o, Atom):
-            # TODO: Erlang can support utf-8 atoms, but until all of the
-            # clients we know can speak it, we are going to continue sending
-            # the latin-1 encoded deprecated style.
-            obj = PyUnicode_AsEncodedString(o, 'latin-1', 'strict')
-            ret = erlpack_append_atom(&self.pk, PyBytes_AS_STRING(obj), PyBytes_Size(obj))
+        elif kind == PACK_UNICODE:
+            ret = self._encode_unicode(o)
+
+        elif kind == PACK_FRAGMENT:
+            obj = (<Fragment> o).encoded
+            ret = erlpack_buffer_write(&self.pk, PyBytes_AS_STRING(obj), PyBytes_GET_SIZE(obj))
 
-        elif PyBytes_Check(o):
-            ret = erlpack_append_binary(&self.pk, PyBytes_AS_STRING(o), PyBytes_GET_SIZE(o))
+        elif kind == PACK_ATOM:
+            ret = self._encode_atom(o)
 
-        elif PyUnicode_Check(o):
-            ret = self._encode_unicode(o)
+        elif kind == PACK_BYTES:
+            ret = self._append_binary(o, PyBytes_AS_STRING(o), PyBytes_GET_SIZE(o))
 
-        elif PyTuple_Check(o):
+        elif kind == PACK_TUPLE:
             sizeval = PyTuple_Size(o)
             if sizeval > MAX_SIZE:
                 raise ValueError('tuple is too large')
@@ -180,7 +901,7 @@ cdef class ErlangTermEncoder(object):
                 if ret != 0:
                     return ret
 
-        elif PyList_Check(o):
+        elif kind == PACK_LIST:
             sizeval = PyList_Size(o)
             if sizeval == 0:
                 ret = erlpack_append_nil_ext(&self.pk)
@@ -200,7 +921,7 @@ cdef class ErlangTermEncoder(object):
 
                 ret = erlpack_append_nil_ext(&self.pk)
 
-        elif PyDict_CheckExact(o):
+        elif kind == PACK_DICT:
             d = <dict> o
             sizeval = PyDict_Size(d)
 
@@ -221,7 +942,7 @@ cdef class ErlangTermEncoder(object):
                     return ret
 
         # For user dict types, safer to use .items() # via msgpack-python
-        elif PyDict_Check(o):
+        elif kind == PACK_DICT_SUBCLASS:
             sizeval = PyDict_Size(o)
             if sizeval > MAX_SIZE:
                 raise ValueError("dict is too large")
@@ -239,10 +960,31 @@ cdef class ErlangTermEncoder(object):
                 if ret != 0:
                     return ret
 
+        elif kind == PACK_SCHEMA:
+            ret = self._pack_schema(self._schema_of(type(o)), o, nest_limit)
+
+        elif kind == PACK_ERLPACK:
+            obj = o.__erlpack__()
+            return self._pack(obj, nest_limit - 1)
+
+        elif kind == PACK_MAP_STREAM:
+            ret = self._pack_stream(iter(o.items), True, nest_limit)
+
+        # The kind only looks at the type, which misses `__erlpack__` on proxies that forward attributes with
+        # `__getattr__` and on instances it was assigned to, so those are asked before falling back.
         elif PyObject_HasAttrString(o, '__erlpack__'):
             obj = o.__erlpack__()
             return self._pack(obj, nest_limit - 1)
 
+        elif kind == PACK_ITER:
+            # Iterators the encode hook knows how to pack, such as file objects, go through it instead.
+            if self._encode_hook:
+                obj = self._encode_hook(o)
+                if obj is not None:
+                    return self._pack(obj, nest_limit - 1)
+
+            ret = self._pack_stream(o, False, nest_limit)
+
         else:
             if self._encode_hook:
                 obj = self._encode_hook(o)
@@ -253,49 +995,393 @@ cdef class ErlangTermEncoder(object):
 
         return ret
 
+    cdef int _pack_stream(self, object iterator, bool as_map, int nest_limit) except? -1:
+        """
+        Packs what `iterator` yields as a list, or as a map of its (key, value) pairs, without knowing the count up
+        front: the header is written with a placeholder arity that gets patched once the iterator is exhausted.
+        """
+        cdef size_t offset = self.pk.length
+        cdef size_t count = 0
+        cdef int ret
+
+        if as_map:
+            ret = erlpack_append_map_header(&self.pk, 0)
+        else:
+            ret = erlpack_append_list_header(&self.pk, 0)
+        if ret != 0:
+            return ret
+
+        for item in iterator:
+            if count == MAX_SIZE:
+                raise ValueError('map is too large' if as_map else 'list is too large')
+
+            if as_map:
+                k, v = item
+                ret = self._pack(k, nest_limit - 1)
+                if ret != 0:
+                    return ret
+
+                ret = self._pack(v, nest_limit - 1)
+            else:
+                ret = self._pack(item, nest_limit - 1)
+
+            if ret != 0:
+                return ret
+
+            count += 1
+
+        if not as_map and count == 0:
+            # Like an empty list, an exhausted iterator is just NIL_EXT.
+            self.pk.length = offset
+            return erlpack_append_nil_ext(&self.pk)
+
+        erlpack_patch_header_size(&self.pk, offset, count)
+        if as_map:
+            return 0
+
+        return erlpack_append_nil_ext(&self.pk)
+
+    cdef int _encode_big(self, object o) except? -1:
+        """
+        Packs an int that does not fit in 64 bits as SMALL_BIG_EXT or LARGE_BIG_EXT. The magnitude is written
+        straight into the buffer.
+        """
+        cdef size_t size = (_PyLong_NumBits(o) + 7) // 8
+        cdef bint negative = o < 0
+        cdef int ret
+
+        if size > MAX_SIZE:
+            raise ValueError('int is too large')
+
+        ret = erlpack_append_big_header(&self.pk, size, negative)
+        if ret == 0:
+            ret = erlpack_buffer_reserve(&self.pk, size)
+        if ret != 0:
+            return ret
+
+        erlpack_long_magnitude(-o if negative else o, <unsigned char *> self.pk.buf + self.pk.length, size)
+        self.pk.length += size
+        return 0
+
+    cdef int _encode_atom(self, object atom) except? -1:
+        cdef const erlpack_atom_entry *entry
+        cdef object obj
+        cdef int ret
+
+        # The one byte per character form of a str is its latin-1 encoding, which the cache is keyed by.
+        if PyUnicode_KIND(atom) == PyUnicode_1BYTE_KIND:
+            entry = erlpack_atom_table_find(&self._atoms, <const char *> PyUnicode_1BYTE_DATA(atom),
+                                            PyUnicode_GET_LENGTH(atom), 0)
+            if entry != NULL:
+                return erlpack_append_encoded_atom(&self.pk, entry)
+
+        # TODO: Erlang can support utf-8 atoms, but until all of the
+        # clients we know can speak it, we are going to continue sending
+        # the latin-1 encoded deprecated style.
+        obj = PyUnicode_AsEncodedString(atom, 'latin-1', 'strict')
+        ret = erlpack_append_atom(&self.pk, PyBytes_AS_STRING(obj), PyBytes_Size(obj))
+        if ret == 0:
+            erlpack_atom_table_add(&self._atoms, PyBytes_AS_STRING(obj), PyBytes_GET_SIZE(obj), 0)
+        return ret
+
     cdef _encode_unicode(self, object obj):
+        cdef object st = None
+        cdef const char *data
+        cdef Py_ssize_t length
+
         if not self._encoding:
             return self._pack([ord(x) for x in obj])
 
-        cdef object st = PyUnicode_AsEncodedString(obj, self._encoding, self._unicode_errors)
-        cdef size_t size = PyBytes_Size(st)
+        if self._utf8:
+            # The UTF-8 form is cached on the str object (for ASCII it is the str's own storage), so this does
+            # not copy, and `_size` gets the same bytes.
+            data = PyUnicode_AsUTF8AndSize(obj, &length)
+        else:
+            st = PyUnicode_AsEncodedString(obj, self._encoding, self._unicode_errors)
+            data = PyBytes_AS_STRING(st)
+            length = PyBytes_GET_SIZE(st)
 
-        if self._unicode_type == b'binary':
+        cdef size_t size = length
+
+        if self._binary_unicode:
             if size > MAX_SIZE:
                 raise ValueError('unicode string is too large using unicode type binary')
 
-            return erlpack_append_binary(&self.pk, PyBytes_AS_STRING(st), size)
+            if st is None and self._segments_out != NULL and size >= self._segments_out.threshold:
+                # Referenced segments need an object that exposes the bytes.
+                st = PyUnicode_AsUTF8String(obj)
+                data = PyBytes_AS_STRING(st)
+
+            return self._append_binary(st, data, size)
 
-        elif self._unicode_type == b'str':
+        elif self._str_unicode:
             if size > 0xFFF:
                 raise ValueError('unicode string is too large using unicode type str')
 
-            return erlpack_append_string(&self.pk, PyBytes_AS_STRING(st), size)
+            return erlpack_append_string(&self.pk, data, size)
 
         else:
             raise TypeError('Unknown unicode encoding type %s' % self._unicode_type)
 
-    cpdef pack(self, object obj):
+    cdef _encode(self, object obj):
+        cdef int ret
+        ret = erlpack_append_version(&self.pk)
+        if ret == -1:
+            raise MemoryError
+
+        ret = self._pack(obj, DEFAULT_RECURSE_LIMIT)
+        if ret == -1:
+            raise MemoryError
+        elif ret:  # should not happen.
+            raise TypeError('_pack returned code(%s)' % ret)
+
+    cdef bytes _freeze(self, object obj):
+        """
+        Returns the encoding of `obj` without the version byte, never compressed, for use as a `Fragment`.
+        """
+        self._acquire()
+        try:
+            self._ensure_buf()
+            self._encode(obj)
+            return PyBytes_FromStringAndSize(self.pk.buf + 1, self.pk.length - 1)
+        finally:
+            self._release_buf()
+            self._in_use = False
+
+    cdef bint _pack_fixed(self, object obj, char *out, Py_ssize_t size) except -1:
+        """
+        Packs `obj` straight into the `size` bytes at `out`. Returns False if the encoding turned out not to be
+        `size` bytes long, in which case the caller falls back to the growable buffer.
+        """
+        cdef erlpack_buffer saved = self.pk
         cdef int ret
-        self._ensure_buf()
-        if self._in_use:
-            raise RuntimeError("Attempting to reuse an ErlangTermEncoder that is currently encoding something")
 
-        self._in_use = True
+        erlpack_buffer_init_fixed(&self.pk, out, size)
         try:
             ret = erlpack_append_version(&self.pk)
-            if ret == -1:
-                raise MemoryError
+            if ret == 0:
+                ret = self._pack(obj, DEFAULT_RECURSE_LIMIT)
 
-            ret = self._pack(obj, DEFAULT_RECURSE_LIMIT)
-            if ret == -1:
-                raise MemoryError
-            elif ret:  # should not happen.
-                raise TypeError('_pack returned code(%s)' % ret)
+            return ret == 0 and self.pk.length == <size_t> size
+        finally:
+            self.pk = saved
+
+    cdef object _pack_exact(self, object obj, Py_ssize_t size):
+        """
+        Packs `obj` straight into a bytes object of exactly `size` bytes, or returns None like `_pack_fixed`.
+        """
+        cdef object buf = PyBytes_FromStringAndSize(NULL, size)
+        return buf if self._pack_fixed(obj, PyBytes_AS_STRING(buf), size) else None
+
+    cpdef pack(self, object obj):
+        cdef Py_ssize_t size
 
-            buf = PyBytes_FromStringAndSize(self.pk.buf, self.pk.length)
+        self._acquire()
+        try:
+            # Size the term first so the result can be allocated once and written in place. Terms that cannot
+            # be sized up front go through the growable buffer and get copied out of it.
+            size = self._size(obj, DEFAULT_RECURSE_LIMIT)
+            if size != UNKNOWN_SIZE:
+                buf = self._pack_exact(obj, erlpack_sizeof_version() + size)
+                if buf is not None:
+                    self._direct_packs += 1
+                    compressed = self._compress(PyBytes_AS_STRING(buf), PyBytes_GET_SIZE(buf))
+                    return buf if compressed is None else compressed
+
+            self._ensure_buf()
+            self._encode(obj)
+            buf = self._compress(self.pk.buf, self.pk.length)
+            if buf is None:
+                buf = PyBytes_FromStringAndSize(self.pk.buf, self.pk.length)
             return buf
         finally:
-            self._free_big_buf()
+            self._release_buf()
+            self._in_use = False
+
+    def pack_into(self, object obj, object buffer, Py_ssize_t offset=0):
+        """
+        Packs `obj` into the writable `buffer`, such as a bytearray or a writable memoryview, starting at `offset`,
+        and returns the number of bytes written. Raises ValueError when the term does not fit in the space left
+        after `offset`, in which case `buffer` is not written to.
+
+        Terms that run no code of their own while packed are sized and written in place; the rest are encoded
+        aside first. Only a term that another thread changes while it is written in place raises ValueError after
+        writing, and leaves what follows `offset` in `buffer` undefined.
+        """
+        cdef Py_buffer view
+        cdef bint holds_view = False
+        cdef Py_ssize_t size
+        cdef Py_ssize_t available
+        cdef char *out
+        cdef const char *data
+        cdef object compressed
+
+        self._acquire()
+        try:
+            PyObject_GetBuffer(buffer, &view, PyBUF_WRITABLE)
+            holds_view = True
+            if offset < 0 or offset > view.len:
+                raise ValueError('Offset %d is outside of the buffer' % offset)
+
+            out = <char *> view.buf + offset
+            available = view.len - offset
+
+            # A term of known size is written in place, once it is clear it fits. Compressed terms are only
+            # known once deflated, so they are encoded aside first like terms that cannot be sized.
+            size = UNKNOWN_SIZE if self._compressed else self._size(obj, DEFAULT_RECURSE_LIMIT)
+            if size != UNKNOWN_SIZE:
+                size += erlpack_sizeof_version()
+                if size > available:
+                    raise ValueError('Buffer is too small: the term takes %d bytes, %d are left' % (size, available))
+
+                # Sized terms run no user code, so this only fails if another thread changed the term. Part
+                # of it may already be in `buffer`, so it is not encoded again to be copied over.
+                if not self._pack_fixed(obj, out, size):
+                    raise ValueError('The term changed size while it was packed into the buffer')
+                self._direct_packs += 1
+                return size
+
+            self._ensure_buf()
+            self._encode(obj)
+            compressed = self._compress(self.pk.buf, self.pk.length)
+            if compressed is None:
+                data = self.pk.buf
+                size = self.pk.length
+            else:
+                data = PyBytes_AS_STRING(compressed)
+                size = PyBytes_GET_SIZE(compressed)
+
+            if size > available:
+                raise ValueError('Buffer is too small: the term takes %d bytes, %d are left' % (size, available))
+
+            memcpy(out, data, size)
+            return size
+        finally:
+            if holds_view:
+                PyBuffer_Release(&view)
+            self._release_buf()
+            self._in_use = False
+
+    cpdef list pack_segments(self, object obj):
+        """
+        Packs `obj` into a list of memoryviews that concatenate to the same bytes `pack` would return, suitable
+        for `socket.sendmsg` or `os.writev`. Binaries of at least `segment_threshold` bytes are not copied: their
+        segment is a view of the original bytes object. Segments are never compressed.
+        """
+        cdef list segments
+        cdef object head
+        cdef size_t i
+        cdef size_t start = 0
+        cdef erlpack_segment *seg
+
+        self._acquire()
+        erlpack_segments_init(&self._segments, self._segment_threshold)
+        self._segments_out = &self._segments
+        self._segment_owners = []
+        try:
+            self._ensure_buf()
+            self._encode(obj)
+
+            head = memoryview(PyBytes_FromStringAndSize(self.pk.buf, self.pk.length))
+            segments = []
+            for i in range(self._segments.count):
+                seg = &self._segments.items[i]
+                if seg.offset > start:
+                    segments.append(head[start:seg.offset])
+
+                segments.append(memoryview(self._segment_owners[i]))
+                start = seg.offset
+
+            if self.pk.length > start:
+                segments.append(head[start:])
+
+            return segments
+        finally:
+            self._segments_out = NULL
+            self._segment_owners = None
+            erlpack_segments_free(&self._segments)
+            self._release_buf()
             self._in_use = False
 
+
+cdef class Fragment(object):
+    """
+    A term encoded once, up front. Packing a Fragment copies its bytes as they are, so the constant parts of a
+    message, such as envelope keys or fixed atoms, are not encoded again every time. `encoder` picks the options
+    the value is encoded with; the compression options do not apply.
+    """
+    cdef readonly bytes encoded
+
+    def __init__(self, value, ErlangTermEncoder encoder=None):
+        if encoder is None:
+            encoder = _fragment_encoders.get()
+
+        self.encoded = encoder._freeze(value)
+
+    def __repr__(self):
+        return 'Fragment(%r)' % (self.encoded,)
+
+
+cdef class EncoderPool(object):
+    """
+    Hands out one ErlangTermEncoder per thread, each created on first use with the keyword arguments given here,
+    so threads pack concurrently without sharing an encoder and each keeps reusing its own buffer.
+    """
+    cdef dict _options
+    cdef object _local
+    cdef object _encoders
+    cdef list _schemas
+
+    def __init__(self, **options):
+        self._options = options
+        self._local = threading.local()
+        self._encoders = weakref.WeakSet()
+        self._schemas = []
+        # Fails early on options the encoder does not accept.
+        self.get()
+
+    cpdef ErlangTermEncoder get(self):
+        """Returns the calling thread's encoder."""
+        cdef ErlangTermEncoder encoder = getattr(self._local, 'encoder', None)
+        if encoder is None:
+            encoder = ErlangTermEncoder(**self._options)
+            self._local.encoder = encoder
+            self._encoders.add(encoder)
+
+        while encoder._pool_schemas < len(self._schemas):
+            encoder.register_schema(*self._schemas[encoder._pool_schemas])
+            encoder._pool_schemas += 1
+
+        return encoder
+
+    def register_schema(self, cls, fields=None, as_='map', tag=None):
+        """Registers the schema with the encoder of every thread, see ErlangTermEncoder.register_schema."""
+        cdef ErlangTermEncoder encoder = self.get()
+        schema = encoder.register_schema(cls, fields, as_, tag)
+        self._schemas.append((cls, fields, as_, tag))
+        encoder._pool_schemas += 1
+        return schema
+
+    def pack(self, object obj):
+        return self.get().pack(obj)
+
+    def pack_into(self, object obj, object buffer, Py_ssize_t offset=0):
+        return self.get().pack_into(obj, buffer, offset)
+
+    def pack_segments(self, object obj):
+        return self.get().pack_segments(obj)
+
+    def stats(self):
+        """
+        Sums the `buffer_stats` of the encoders of threads that are still alive, along with how many there are.
+        """
+        totals = {'encoders': 0, 'allocated': 0, 'reused': 0, 'released': 0, 'direct': 0, 'retained': 0}
+        for encoder in list(self._encoders):
+            totals['encoders'] += 1
+            for key, value in encoder.buffer_stats.items():
+                totals[key] += value
+
+        return totals
+
+
+cdef EncoderPool _fragment_encoders = EncoderPool()
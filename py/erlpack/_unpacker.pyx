@@ -1,338 +1,1263 @@
+#cython: freethreading_compatible=True
 """
 Unpacker based on work from Samuel Stauffer's `python-erlastic` library. See COPYING.
 """
 
-from __future__ import division
-import struct
-import zlib
-from .constants import *
-from .types import *
+cimport cython
 from cpython cimport *
-import cython
+from libc.stdint cimport *
+from libc.stdlib cimport malloc, free
+from libc.string cimport memcmp
+from collections.abc import Mapping, Sequence
+from sys import intern
+import threading
+from .types import Atom, Export, PID, Port, Reference
 
-__all__ = ['ErlangTermDecoder', 'ErlangTermDecodeError']
+__all__ = ['DecoderPool', 'ErlangTermDecoder', 'ErlangTermDecodeError', 'LazyList', 'LazyMap', 'TermIterator', 'Unpacker']
 
+cdef extern from "Python.h":
+    object _PyLong_FromByteArray(const unsigned char *bytes, size_t n, int little_endian, int is_signed)
+    dict _PyDict_NewPresized(Py_ssize_t minused)
+    int Py_EnterRecursiveCall(const char *where) except *
+    void Py_LeaveRecursiveCall()
 
-class ErlangTermDecodeError(Exception):
+cdef extern from "../../cpp/constants.h":
+    int FORMAT_VERSION
+    int NIL_EXT
+
+cdef extern from "../../cpp/decoder.h":
+    ctypedef enum erlpack_token_type:
+        ERLPACK_TOKEN_INTEGER
+        ERLPACK_TOKEN_FLOAT
+        ERLPACK_TOKEN_ATOM
+        ERLPACK_TOKEN_ATOM_UTF8
+        ERLPACK_TOKEN_BINARY
+        ERLPACK_TOKEN_STRING
+        ERLPACK_TOKEN_BIG
+        ERLPACK_TOKEN_NIL
+        ERLPACK_TOKEN_LIST
+        ERLPACK_TOKEN_TUPLE
+        ERLPACK_TOKEN_MAP
+        ERLPACK_TOKEN_REFERENCE
+        ERLPACK_TOKEN_NEW_REFERENCE
+        ERLPACK_TOKEN_PORT
+        ERLPACK_TOKEN_PID
+        ERLPACK_TOKEN_EXPORT
+        ERLPACK_TOKEN_COMPRESSED
+
+    struct erlpack_token:
+        erlpack_token_type type
+        unsigned char tag
+        int sign
+        int64_t integer
+        double number
+        const uint8_t *bytes
+        size_t length
+
+    struct erlpack_decoder:
+        const uint8_t *data
+        size_t size
+        size_t offset
+        const char *error
+        void *source
+
+    void erlpack_decoder_init(erlpack_decoder *d, const uint8_t *data, size_t size)
+    int erlpack_decoder_read8(erlpack_decoder *d, uint8_t *out)
+    int erlpack_decoder_read32(erlpack_decoder *d, uint32_t *out)
+    int erlpack_decoder_read_tail(erlpack_decoder *d)
+    int erlpack_decoder_next(erlpack_decoder *d, erlpack_token *tok)
+    int erlpack_decoder_skip(erlpack_decoder *d)
+
+cdef extern from "../../cpp/compress.h":
+    size_t erlpack_decompress_term(const uint8_t *data, size_t available, uint8_t *out, size_t size) nogil
+    int erlpack_decompress_size_ok(size_t size, size_t available)
+
+cdef extern from "../../cpp/framing.h":
+    struct erlpack_frames:
+        pass
+
+    int erlpack_frames_init(erlpack_frames *f, int packet)
+    void erlpack_frames_free(erlpack_frames *f)
+    size_t erlpack_frames_pending(const erlpack_frames *f)
+    int erlpack_frames_feed(erlpack_frames *f, const void *data, size_t length)
+    int erlpack_frames_next(erlpack_frames *f, const uint8_t **frame, size_t *length)
+
+
+cdef extern from "../../cpp/intern.h":
+    struct erlpack_intern_table:
+        size_t capacity
+
+    int erlpack_intern_table_init(erlpack_intern_table *t, size_t capacity)
+    void erlpack_intern_table_free(erlpack_intern_table *t, void (*release)(void *value))
+    void *erlpack_intern_table_find(const erlpack_intern_table *t, int kind, const char *bytes, size_t length)
+    void *erlpack_intern_table_store(erlpack_intern_table *t, int kind, const char *bytes, size_t length,
+                                     void *value)
+
+cdef size_t DEFAULT_ATOM_CACHE_SIZE = 1024
+cdef size_t DEFAULT_KEY_CACHE_SIZE = 1024
+# Binary map keys up to this many bytes are deduplicated.
+cdef size_t MAX_INTERNED_KEY_LENGTH = 64
+# Compressed terms inflating to at least this many bytes are inflated with the GIL released.
+cdef size_t MIN_NOGIL_INFLATE_SIZE = 64 * 1024
+
+# Kinds of interned values, see cpp/intern.h.
+cdef enum:
+    INTERN_ATOM = 0
+    INTERN_ATOM_UTF8 = 1
+    INTERN_KEY = 2
+
+
+cdef void _release_interned(void *value) noexcept:
+    Py_DECREF(<object> value)
+
+
+cdef inline void _set_views(erlpack_decoder *d, object views):
+    """Keeps the memoryview binaries are sliced out of, see ErlangTermDecoder._views_of. `views` must outlive `d`."""
+    d.source = NULL if views is None else <void *> views
+
+
+class ErlangTermDecodeError(ValueError):
     pass
 
 
 # noinspection PyMethodMayBeStatic,PyPep8Naming,PyShadowingBuiltins,PyUnusedLocal
 cdef class ErlangTermDecoder(object):
-    cdef object encoding
-    def __init__(self, encoding=None):
-        self.encoding = encoding
+    """
+    Decodes terms straight out of anything that supports the buffer protocol (bytes, bytearray, memoryview,
+    mmap, ...), without copying it first.
+
+    Up to `atom_cache_size` atoms are interned: an atom that was decoded before comes back as the same Atom
+    object instead of a new one. Pass 0 to build a new Atom every time.
+
+    Binary map keys are deduplicated the same way, with up to `key_cache_size` of them kept. When `encoding` is
+    set they are also interned with sys.intern, so looking them up in the decoded dicts compares by identity.
+
+    Hooks turn terms into other objects while they are decoded, innermost first:
+
+    - `object_hook` is called with every decoded map (a dict) and returns what the map decodes to.
+    - `record_factories` maps record tags to callables. A tuple whose first element is an atom found in it,
+      `{user, Id, Name}` say, decodes to `record_factories['user'](Id, Name)`.
+    - `tuple_hook` is called with every other decoded tuple and returns what it decodes to.
+
+    With `binary_mode='memoryview'`, binaries decode to read-only memoryview slices of the buffer being decoded
+    instead of bytes copied out of it. The slices keep that buffer alive, and a bytearray or mmap cannot be
+    resized or closed while they exist. Map keys are still bytes, as they have to be hashable.
+    """
+    cdef bytes encoding
+    cdef erlpack_intern_table _atoms
+    cdef erlpack_intern_table _keys
+    cdef object _object_hook
+    cdef object _tuple_hook
+    cdef dict _record_factories
+    cdef bint _binary_views
+
+    def __init__(self, encoding=None, atom_cache_size=DEFAULT_ATOM_CACHE_SIZE,
+                 key_cache_size=DEFAULT_KEY_CACHE_SIZE, object_hook=None, tuple_hook=None, record_factories=None,
+                 binary_mode='bytes'):
+        if isinstance(encoding, unicode):
+            encoding = encoding.encode('ascii')
+
+        self.encoding = encoding or None
+
+        if binary_mode not in ('bytes', 'memoryview'):
+            raise ValueError("binary_mode must be 'bytes' or 'memoryview', not %r" % (binary_mode,))
+        if binary_mode == 'memoryview' and self.encoding:
+            raise ValueError("binary_mode='memoryview' cannot be combined with an encoding")
+        self._binary_views = binary_mode == 'memoryview'
+
+        erlpack_intern_table_free(&self._atoms, _release_interned)
+        if erlpack_intern_table_init(&self._atoms, atom_cache_size) < 0:
+            raise MemoryError
+
+        erlpack_intern_table_free(&self._keys, _release_interned)
+        if erlpack_intern_table_init(&self._keys, key_cache_size) < 0:
+            raise MemoryError
+
+        self._object_hook = object_hook
+        self._tuple_hook = tuple_hook
+        self._record_factories = dict(record_factories) if record_factories else None
+
+    def __dealloc__(self):
+        erlpack_intern_table_free(&self._atoms, _release_interned)
+        erlpack_intern_table_free(&self._keys, _release_interned)
+
+    def loads(self, data, Py_ssize_t offset=0, paths=None, default=None):
+        """
+        Decodes the term at `offset`. With `paths`, only the values at those paths are decoded and returned as a
+        tuple, in the same order, and everything else is skipped over. A path is a sequence of map keys (str,
+        bytes or int) and list or tuple indexes, such as `('d', 'author', 'id')`; a single key is a path of one.
+        Paths that are not in the term give `default`.
+        """
+        if paths is not None:
+            return self._loads_paths(data, offset, paths, default)
+        return self._loads(data, offset, NULL)
+
+    def loads_with_offset(self, data, Py_ssize_t offset=0):
+        """
+        Like loads(), but returns `(term, end)`, where `end` is the offset just past the term. That is where
+        the next one starts when several terms are packed back to back.
+        """
+        cdef Py_ssize_t end = 0
+        term = self._loads(data, offset, &end)
+        return term, end
+
+    def iter_unpack(self, data, Py_ssize_t offset=0):
+        """
+        Iterates over the terms packed back to back in `data`, starting at `offset`, until the end of the
+        buffer. `data` is held, not copied, for as long as the iterator is alive.
+        """
+        return TermIterator(self, data, offset)
+
+    cdef object _loads_paths(self, data, Py_ssize_t offset, paths, default):
+        cdef Py_buffer view
+        cdef erlpack_decoder dec
+        cdef PathNode root = PathNode.build(paths)
+        cdef list results = [default] * root.pending
+        cdef object views = self._views_of(data)
+
+        PyObject_GetBuffer(data, &view, PyBUF_SIMPLE)
+        try:
+            if offset < 0 or offset >= view.len:
+                raise ErlangTermDecodeError('Offset %d is outside of the buffer' % offset)
+
+            erlpack_decoder_init(&dec, <const uint8_t *> view.buf, view.len)
+            _set_views(&dec, views)
+            dec.offset = offset
+            self._read_version(&dec)
+            self._project(&dec, root, results, False)
+            return tuple(results)
+        finally:
+            PyBuffer_Release(&view)
+
+    cdef int _project(self, erlpack_decoder *d, PathNode node, list results, bint need_end) except -1:
+        """
+        Stores the values `node` asks for out of the term at `d` in `results`. Leaves `d` past the end of the
+        term when `need_end` is set, and anywhere inside it otherwise.
+        """
+        cdef erlpack_token tok
+        cdef size_t start = d.offset
+        cdef size_t i
+        cdef bytes inflated
+        cdef erlpack_decoder inner
+
+        if node.leaves:
+            value = self._decode(d)
+            for i in node.leaves:
+                results[i] = value
+            node.resolve_decoded(value, results)
+            return 0
+
+        if erlpack_decoder_next(d, &tok) < 0:
+            self._fail(d)
+
+        if tok.type == ERLPACK_TOKEN_MAP:
+            self._check_arity(d, tok.length, 2)
+            for i in range(tok.length):
+                if node.pending == 0:
+                    if not need_end:
+                        return 0
+                    self._skip(d)
+                    self._skip(d)
+                else:
+                    self._project_child(d, node, self._match_key(d, node), results, need_end)
+            return 0
+
+        elif tok.type == ERLPACK_TOKEN_LIST or tok.type == ERLPACK_TOKEN_TUPLE:
+            self._check_arity(d, tok.length, 1)
+            for i in range(tok.length):
+                if node.pending == 0:
+                    if not need_end:
+                        return 0
+                    self._skip(d)
+                else:
+                    self._project_child(d, node, node.match_index(i), results, need_end)
+
+            if tok.type == ERLPACK_TOKEN_LIST and need_end and erlpack_decoder_read_tail(d) < 0:
+                self._fail(d)
+            return 0
+
+        elif tok.type == ERLPACK_TOKEN_COMPRESSED:
+            inflated = self._inflate(d, &tok)
+            views = self._views_of(inflated)
+            erlpack_decoder_init(&inner, <const uint8_t *> PyBytes_AS_STRING(inflated), tok.length)
+            _set_views(&inner, views)
+            return self._project(&inner, node, results, False)
+
+        # Paths that go further than a scalar are not in the term.
+        if need_end:
+            d.offset = start
+            self._skip(d)
+        return 0
+
+    cdef int _project_child(self, erlpack_decoder *d, PathNode node, PathNode child, list results,
+                            bint need_end) except -1:
+        cdef Py_ssize_t pending
+
+        if child is None:
+            return self._skip(d)
+
+        # Once a child was walked, whatever it did not find is not there.
+        pending = child.pending
+        self._project(d, child, results, need_end or node.pending > pending)
+        node.pending -= pending
+        return 0
+
+    cdef PathNode _match_key(self, erlpack_decoder *d, PathNode node):
+        cdef erlpack_token tok
+        cdef size_t start = d.offset
+
+        if erlpack_decoder_next(d, &tok) < 0:
+            self._fail(d)
+
+        if (tok.type == ERLPACK_TOKEN_BINARY or tok.type == ERLPACK_TOKEN_ATOM or
+                tok.type == ERLPACK_TOKEN_ATOM_UTF8):
+            return node.match_bytes(<const char *> tok.bytes, tok.length)
+
+        elif tok.type == ERLPACK_TOKEN_INTEGER:
+            return node.match_int(tok.integer)
+
+        d.offset = start
+        self._skip(d)
+        return None
+
+    cdef int _skip(self, erlpack_decoder *d) except -1:
+        if erlpack_decoder_skip(d) < 0:
+            self._fail(d)
+        return 0
+
+    cdef object _loads(self, data, Py_ssize_t offset, Py_ssize_t *end):
+        cdef Py_buffer view
+        cdef erlpack_decoder dec
+        cdef object views = self._views_of(data)
+
+        PyObject_GetBuffer(data, &view, PyBUF_SIMPLE)
+        try:
+            if offset < 0 or offset >= view.len:
+                raise ErlangTermDecodeError('Offset %d is outside of the buffer' % offset)
+
+            erlpack_decoder_init(&dec, <const uint8_t *> view.buf, view.len)
+            _set_views(&dec, views)
+            dec.offset = offset
+            term = self._decode_term(&dec)
+            if end != NULL:
+                end[0] = dec.offset
+            return term
+        finally:
+            PyBuffer_Release(&view)
+
+    def loads_lazy(self, data, Py_ssize_t offset=0):
+        """
+        Decodes only as much of the term as gets used. Maps and lists come back as LazyMap and LazyList
+        proxies that hold on to `data` and decode each of their values the first time it is read, skipping
+        over the others. Errors in parts of the term that are never read go unnoticed. `object_hook` is not
+        called for maps that come back as a LazyMap.
+        """
+        cdef LazySource source = LazySource(self, data)
+        cdef erlpack_decoder dec
+
+        if offset < 0 or offset >= source.view.len:
+            raise ErlangTermDecodeError('Offset %d is outside of the buffer' % offset)
+
+        source.init_decoder(&dec, offset)
+        self._read_version(&dec)
+        return source.decode(&dec)
 
-    def loads(self, bytes, offset=0):
-        version = ord(bytes[offset:offset+1])
+    cdef object _views_of(self, data):
+        """The read-only bytes memoryview of `data` binaries get sliced out of, or None when they are copied."""
+        if not self._binary_views:
+            return None
+        return memoryview(data).cast('B').toreadonly()
+
+    cdef int _read_version(self, erlpack_decoder *d) except -1:
+        cdef uint8_t version = d.data[d.offset]
         if version != FORMAT_VERSION:
             raise ErlangTermDecodeError('Bad version number. Expected %d found %d' % (FORMAT_VERSION, version))
-        return self.decode_part(bytes, offset + 1)[0]
 
-    cdef object decode_part(self, bytes, offset=0):
-        opcode = bytes[offset:offset+1]
+        d.offset += 1
+        return 0
+
+    cdef object _decode_term(self, erlpack_decoder *d):
+        self._read_version(d)
+        return self._decode(d)
+
+    cdef int _fail(self, erlpack_decoder *d) except -1:
+        raise ErlangTermDecodeError(d.error.decode('ascii'))
 
-        if opcode == b'a':
-            return self.decode_a(bytes, offset + 1)
+    cdef object _decode(self, erlpack_decoder *d):
+        cdef erlpack_token tok
 
-        elif opcode == b'b':
-            return self.decode_b(bytes, offset + 1)
+        if erlpack_decoder_next(d, &tok) < 0:
+            self._fail(d)
+        return self._decode_token(d, &tok)
 
-        elif opcode == b'c':
-            return self.decode_c(bytes, offset + 1)
+    cdef object _decode_key(self, erlpack_decoder *d):
+        cdef erlpack_token tok
 
-        elif opcode == b'F':
-            return self.decode_F(bytes, offset + 1)
+        if erlpack_decoder_next(d, &tok) < 0:
+            self._fail(d)
 
-        elif opcode == b'd':
-            return self.decode_d(bytes, offset + 1)
+        if tok.type != ERLPACK_TOKEN_BINARY:
+            return self._decode_token(d, &tok)
 
-        elif opcode == b's':
-            return self.decode_s(bytes, offset + 1)
+        if tok.length > MAX_INTERNED_KEY_LENGTH or self._keys.capacity == 0:
+            return self._decode_binary(&tok)
 
-        elif opcode == b'v':
-            return self.decode_v(bytes, offset + 1)
+        key = self._find_interned(&self._keys, INTERN_KEY, <const char *> tok.bytes, tok.length)
+        if key is not None:
+            return key
 
-        elif opcode == b'w':
-            return self.decode_w(bytes, offset + 1)
+        key = self._decode_binary(&tok)
+        if self.encoding:
+            key = intern(key)
+
+        self._store_interned(&self._keys, INTERN_KEY, <const char *> tok.bytes, tok.length, key)
+        return key
 
-        elif opcode == b't':
-            return self.decode_t(bytes, offset + 1)
+    cdef object _find_interned(self, erlpack_intern_table *t, int kind, const char *bytes, size_t length):
+        """
+        Returns the value interned for `bytes`, or None. The tables are only touched under a critical section
+        on the decoder: without the GIL, the lazy terms and iterators of one decoder can be read from several
+        threads at once.
+        """
+        cdef object value = None
+        cdef void *cached
+        with cython.critical_section(self):
+            cached = erlpack_intern_table_find(t, kind, bytes, length)
+            if cached != NULL:
+                value = <object> cached
+        return value
 
-        elif opcode == b'h':
-            return self.decode_h(bytes, offset + 1)
+    cdef int _store_interned(self, erlpack_intern_table *t, int kind, const char *bytes, size_t length,
+                             object value) except -1:
+        cdef void *evicted
+        Py_INCREF(value)
+        with cython.critical_section(self):
+            evicted = erlpack_intern_table_store(t, kind, bytes, length, <void *> value)
+        if evicted != NULL:
+            Py_DECREF(<object> evicted)
+        return 0
 
-        elif opcode == b'i':
-            return self.decode_i(bytes, offset + 1)
+    cdef object _decode_binary(self, erlpack_token *tok):
+        if self.encoding:
+            return PyUnicode_Decode(<const char *> tok.bytes, tok.length, self.encoding, NULL)
+        return PyBytes_FromStringAndSize(<const char *> tok.bytes, tok.length)
 
-        elif opcode == b'j':
-            return self.decode_j(bytes, offset + 1)
+    cdef object _decode_token(self, erlpack_decoder *d, erlpack_token *tok):
+        if tok.type == ERLPACK_TOKEN_INTEGER:
+            return PyLong_FromLongLong(tok.integer)
 
-        elif opcode == b'k':
-            return self.decode_k(bytes, offset + 1)
+        elif tok.type == ERLPACK_TOKEN_FLOAT:
+            return PyFloat_FromDouble(tok.number)
 
-        elif opcode == b'l':
-            return self.decode_l(bytes, offset + 1)
+        elif tok.type == ERLPACK_TOKEN_ATOM:
+            return self._decode_atom(tok, False)
 
-        elif opcode == b'm':
-            return self.decode_m(bytes, offset + 1)
+        elif tok.type == ERLPACK_TOKEN_ATOM_UTF8:
+            return self._decode_atom(tok, True)
 
-        elif opcode == b'n':
-            return self.decode_n(bytes, offset + 1)
+        elif tok.type == ERLPACK_TOKEN_BINARY:
+            if self._binary_views and d.source != NULL:
+                start = tok.bytes - d.data
+                return (<object> d.source)[start:start + tok.length]
+            return self._decode_binary(tok)
 
-        elif opcode == b'o':
-            return self.decode_o(bytes, offset + 1)
+        elif tok.type == ERLPACK_TOKEN_STRING:
+            return self._decode_string(tok)
 
-        elif opcode == b't':
-            return self.decode_t(bytes, offset + 1)
+        elif tok.type == ERLPACK_TOKEN_BIG:
+            return self._decode_big(tok)
 
-        elif opcode == b'e':
-            return self.decode_e(bytes, offset + 1)
+        elif tok.type == ERLPACK_TOKEN_NIL:
+            return PyList_New(0)
 
-        elif opcode == b'r':
-            return self.decode_r(bytes, offset + 1)
+        elif tok.type == ERLPACK_TOKEN_LIST:
+            return self._decode_list(d, tok.length)
 
-        elif opcode == b'f':
-            return self.decode_f(bytes, offset + 1)
+        elif tok.type == ERLPACK_TOKEN_TUPLE:
+            if self._tuple_hook is not None or self._record_factories is not None:
+                return self._hook_tuple(self._decode_tuple(d, tok.length))
+            return self._decode_tuple(d, tok.length)
 
-        elif opcode == b'g':
-            return self.decode_g(bytes, offset + 1)
+        elif tok.type == ERLPACK_TOKEN_MAP:
+            if self._object_hook is not None:
+                return self._object_hook(self._decode_map(d, tok.length))
+            return self._decode_map(d, tok.length)
 
-        elif opcode == b'q':
-            return self.decode_q(bytes, offset + 1)
+        elif tok.type == ERLPACK_TOKEN_COMPRESSED:
+            return self._decode_compressed(d, tok)
 
-        elif opcode == b'P':
-            return self.decode_P(bytes, offset + 1)
+        elif tok.type == ERLPACK_TOKEN_REFERENCE:
+            return self._decode_reference(d)
 
+        elif tok.type == ERLPACK_TOKEN_NEW_REFERENCE:
+            return self._decode_new_reference(d, tok.length)
+
+        elif tok.type == ERLPACK_TOKEN_PORT:
+            return self._decode_port(d)
+
+        elif tok.type == ERLPACK_TOKEN_PID:
+            return self._decode_pid(d)
+
+        elif tok.type == ERLPACK_TOKEN_EXPORT:
+            return self._decode_export(d)
+
+        raise ErlangTermDecodeError('Unexpected opcode %r' % chr(tok.tag))
+
+    cdef int _check_arity(self, erlpack_decoder *d, size_t length, size_t min_size) except -1:
+        """
+        Every element takes up at least `min_size` bytes, so an arity the rest of the buffer cannot hold is
+        rejected before anything gets allocated for it.
+        """
+        if length > (d.size - d.offset) // min_size:
+            raise ErlangTermDecodeError('Container arity %d passes the end of the buffer' % length)
+        return 0
+
+    cdef object _decode_atom(self, erlpack_token *tok, bint utf8):
+        cdef const char *name = <const char *> tok.bytes
+
+        if tok.length == 3 and memcmp(name, b'nil', 3) == 0:
+            return None
+        elif tok.length == 4 and memcmp(name, b'true', 4) == 0:
+            return True
+        elif tok.length == 5 and memcmp(name, b'false', 5) == 0:
+            return False
+
+        cdef int kind = INTERN_ATOM_UTF8 if utf8 else INTERN_ATOM
+        atom = self._find_interned(&self._atoms, kind, name, tok.length)
+        if atom is not None:
+            return atom
+
+        if utf8:
+            atom = Atom(PyUnicode_DecodeUTF8(name, tok.length, NULL))
         else:
-            raise ValueError('Unexpected opcode %s' % opcode)
-
-    cdef object decode_a(self, bytes, offset):
-        """SMALL_INTEGER_EXT"""
-        return ord(bytes[offset:offset+1]), offset + 1
-
-    cdef object decode_b(self, bytes, offset):
-        """INTEGER_EXT"""
-        return struct.unpack('>l', bytes[offset:offset + 4])[0], offset + 4
-
-    cdef object decode_c(self, bytes, offset):
-        """FLOAT_EXT"""
-        return float(bytes[offset:offset + 31].split('\x00', 1)[0]), offset + 31
-
-    cdef object decode_F(self, bytes, offset):
-        """NEW_FLOAT_EXT"""
-        return struct.unpack('>d', bytes[offset:offset + 8])[0], offset + 8
-
-    cdef object decode_d(self, bytes, offset):
-        """ATOM_EXT"""
-        atom_len, = struct.unpack('>H', bytes[offset:offset + 2])
-        offset += 2
-        atom = bytes[offset:offset + atom_len]
-        return self.convert_atom(atom), offset + atom_len
-
-    cdef object decode_s(self, bytes, offset):
-        """SMALL_ATOM_EXT"""
-        atom_len = ord(bytes[offset:offset+1])
-        offset += 1
-        atom = bytes[offset:offset + atom_len]
-        return self.convert_atom(atom), offset + atom_len
-
-    cdef object decode_v(self, bytes, offset):
-        """ATOM_UTF8_EXT"""
-        atom_len, = struct.unpack('>H', bytes[offset:offset + 2])
-        offset += 2
-        atom = bytes[offset:offset + atom_len]
-        return self.convert_atom(atom, encoding='utf-8'), offset + atom_len
-
-    cdef object decode_w(self, bytes, offset):
-        """SMALL_ATOM_UTF8_EXT"""
-        atom_len = ord(bytes[offset:offset+1])
-        offset += 1
-        atom = bytes[offset:offset + atom_len]
-        return self.convert_atom(atom, encoding='utf-8'), offset + atom_len
-
-    cdef object decode_t(self, bytes, offset):
-        """MAP_EXT"""
-        arity, = struct.unpack('>L', bytes[offset:offset + 4])
-        offset += 4
-        kv = {}
-        for i in xrange(arity):
-            key, offset = self.decode_part(bytes, offset)
-            value, offset = self.decode_part(bytes, offset)
-            kv[key] = value
-        return kv, offset
-
-    cdef object decode_h(self, bytes, offset):
-        """SMALL_TUPLE_EXT"""
-        arity = ord(bytes[offset:offset+1])
-        offset += 1
-        items = []
-        for i in xrange(arity):
-            val, offset = self.decode_part(bytes, offset)
-            items.append(val)
-        return tuple(items), offset
-
-    cdef object decode_i(self, bytes, offset):
-        """LARGE_TUPLE_EXT"""
-        arity, = struct.unpack('>L', bytes[offset:offset + 4])
-        offset += 4
-        items = []
-        for i in xrange(arity):
-            val, offset = self.decode_part(bytes, offset)
-            items.append(val)
-        return tuple(items), offset
-
-    cdef object decode_j(self, bytes, offset):
-        """NIL_EXT"""
-        return [], offset
-
-    cdef object decode_k(self, bytes, offset):
-        """STRING_EXT"""
-        length, = struct.unpack('>H', bytes[offset:offset + 2])
-        offset += 2
-        st = bytes[offset:offset + length]
-        byte_elements_are_ints = isinstance(b'a'[0], int)
-        if byte_elements_are_ints:
-            st = list(st)
-        else:
-            st = [ord(x) for x in st]
-        return st, offset + length
-
-    cdef object decode_l(self, bytes, offset):
-        """LIST_EXT"""
-        length, = struct.unpack('>L', bytes[offset:offset + 4])
-        offset += 4
-        items = []
-        for i in xrange(length):
-            val, offset = self.decode_part(bytes, offset)
-            items.append(val)
-        tail, offset = self.decode_part(bytes, offset)
-        # noinspection PySimplifyBooleanCheck
-        if tail != []:
+            atom = Atom(PyUnicode_DecodeLatin1(name, tok.length, NULL))
+
+        self._store_interned(&self._atoms, kind, name, tok.length, atom)
+        return atom
+
+    cdef object _decode_string(self, erlpack_token *tok):
+        cdef list items = PyList_New(tok.length)
+        cdef size_t i
+        cdef object item
+
+        for i in range(tok.length):
+            item = PyLong_FromLong(tok.bytes[i])
+            Py_INCREF(item)
+            PyList_SET_ITEM(items, i, item)
+
+        return items
+
+    cdef object _decode_big(self, erlpack_token *tok):
+        value = _PyLong_FromByteArray(tok.bytes, tok.length, 1, 0)
+        if tok.sign:
+            return -value
+        return value
+
+    cdef object _decode_list(self, erlpack_decoder *d, size_t length):
+        cdef list items
+        cdef size_t i
+        cdef object item
+
+        self._check_arity(d, length, 1)
+        items = PyList_New(length)
+        Py_EnterRecursiveCall(' while decoding a list')
+        try:
+            for i in range(length):
+                item = self._decode(d)
+                Py_INCREF(item)
+                PyList_SET_ITEM(items, i, item)
+        finally:
+            Py_LeaveRecursiveCall()
+
+        if d.offset < d.size and d.data[d.offset] != NIL_EXT:
             # TODO: Not sure what to do with the tail
             raise NotImplementedError('Lists with non empty tails are not supported')
-        return items, offset
 
-    cdef object decode_m(self, bytes, offset):
-        """BINARY_EXT"""
-        length, = struct.unpack('>L', bytes[offset:offset + 4])
-        offset += 4
-        rv = bytes[offset:offset + length]
-        if self.encoding:
-            rv = rv.decode(self.encoding)
-        return rv, offset + length
-
-    cdef object decode_n(self, bytes, offset):
-        """SMALL_BIG_EXT"""
-        n = ord(bytes[offset:offset+1])
-        offset += 1
-        return self.decode_bigint(n, bytes, offset)
-
-    cdef object decode_o(self, bytes, offset):
-        """LARGE_BIG_EXT"""
-        n, = struct.unpack('>L', bytes[offset:offset + 4])
-        offset += 4
-        return self.decode_bigint(n, bytes, offset)
-
-    @cython.boundscheck(False)
-    cdef object decode_bigint(self, n, bytes, unsigned int offset):
-        cdef unsigned char* cd = <unsigned char*>PyBytes_AsString(bytes)
-        cdef unsigned long long ull
-        cdef unsigned char pos = 0
-
-        if offset + 1 + n > PyBytes_Size(bytes):
-            raise OverflowError("Overflown! %s %s" % (offset + 1 + n, len(bytes)))
-
-        sign = cd[offset]
-        offset += 1
-
-        if sign == 0 and n <= 8:
-            ull = 0
-            for i in range(n):
-                ull |= <unsigned long long>(cd[offset]) << pos
-                pos += 8
-                offset += 1
-
-            return ull, offset
-
-        val = 0
-        b = 1
-        for i in range(n):
-            val += cd[offset] * b
-            b <<= 8
-            offset += 1
-        if sign != 0:
-            val = -val
-        return val, offset
-
-    cdef object decode_e(self, bytes, offset):
-        """REFERENCE_EXT"""
-        node, offset = self.decode_part(bytes, offset)
-        if not isinstance(node, Atom):
-            raise ErlangTermDecodeError('Expected atom while parsing REFERENCE_EXT, found %r instead' % node)
-        reference_id, creation = struct.unpack('>LB', bytes[offset: offset + 5])
-        offset += 5
-        return Reference(node, [reference_id], creation), offset
-
-    cdef object decode_r(self, bytes, offset):
-        """NEW_REFERENCE_EXT"""
-        id_len, = struct.unpack('>H', bytes[offset:offset + 2])
-        offset += 2
-        node, offset = self.decode_part(bytes, offset)
-        if not isinstance(node, Atom):
-            raise ErlangTermDecodeError('Expected atom while parsing NEW_REFERENCE_EXT, found %r instead' % node)
-        creation = ord(bytes[offset])
-        offset += 1
-        reference_id = struct.unpack('>%dL' % id_len, bytes[offset:offset + (4 * id_len)])
-        offset += (4 * id_len)
-        return Reference(node, reference_id, creation), offset
-
-    cdef object decode_f(self, bytes, offset):
-        """PORT_EXT"""
-        node, offset = self.decode_part(bytes, offset)
-        if not isinstance(node, Atom):
-            raise ErlangTermDecodeError('Expected atom while parsing PORT_EXT, found %r instead' % node)
-        port_id, creation = struct.unpack('>LB', bytes[offset:offset + 5])
-        offset += 5
-        return Port(node, port_id, creation), offset
-
-    cdef object decode_g(self, bytes, offset):
-        """PID_EXT"""
-        node, offset = self.decode_part(bytes, offset)
+        if erlpack_decoder_read_tail(d) < 0:
+            self._fail(d)
+
+        return items
+
+    cdef object _decode_tuple(self, erlpack_decoder *d, size_t length):
+        cdef tuple items
+        cdef size_t i
+        cdef object item
+
+        self._check_arity(d, length, 1)
+        items = PyTuple_New(length)
+        Py_EnterRecursiveCall(' while decoding a tuple')
+        try:
+            for i in range(length):
+                item = self._decode(d)
+                Py_INCREF(item)
+                PyTuple_SET_ITEM(items, i, item)
+        finally:
+            Py_LeaveRecursiveCall()
+
+        return items
+
+    cdef object _decode_map(self, erlpack_decoder *d, size_t length):
+        cdef dict kv
+        cdef size_t i
+
+        self._check_arity(d, length, 2)
+        kv = _PyDict_NewPresized(length)
+        Py_EnterRecursiveCall(' while decoding a map')
+        try:
+            for i in range(length):
+                key = self._decode_key(d)
+                value = self._decode(d)
+                PyDict_SetItem(kv, key, value)
+        finally:
+            Py_LeaveRecursiveCall()
+
+        return kv
+
+    cdef object _hook_tuple(self, tuple items):
+        cdef object factory
+
+        if self._record_factories is not None and PyTuple_GET_SIZE(items) > 0 and isinstance(items[0], Atom):
+            factory = self._record_factories.get(items[0])
+            if factory is not None:
+                return factory(*items[1:])
+
+        if self._tuple_hook is not None:
+            return self._tuple_hook(items)
+        return items
+
+    cdef object _decode_compressed(self, erlpack_decoder *d, erlpack_token *tok):
+        cdef erlpack_decoder inner
+        cdef bytes inflated = self._inflate(d, tok)
+        cdef object views = self._views_of(inflated)
+
+        erlpack_decoder_init(&inner, <const uint8_t *> PyBytes_AS_STRING(inflated), tok.length)
+        _set_views(&inner, views)
+        return self._decode(&inner)
+
+    cdef bytes _inflate(self, erlpack_decoder *d, erlpack_token *tok):
+        cdef size_t available = d.size - d.offset
+        cdef size_t consumed
+        cdef bytes inflated
+        cdef uint8_t *out
+
+        # The size comes off the wire, so one that the remaining input could never inflate to is
+        # refused before it is allocated.
+        if not erlpack_decompress_size_ok(tok.length, available):
+            raise ErlangTermDecodeError('Compressed item declares an impossible uncompressed size')
+
+        inflated = PyBytes_FromStringAndSize(NULL, tok.length)
+        out = <uint8_t *> PyBytes_AS_STRING(inflated)
+
+        # The input is pinned by the buffer the caller holds and `inflated` is not shared yet, so
+        # other threads can run while zlib works through a large term.
+        if tok.length >= MIN_NOGIL_INFLATE_SIZE:
+            with nogil:
+                consumed = erlpack_decompress_term(tok.bytes, available, out, tok.length)
+        else:
+            consumed = erlpack_decompress_term(tok.bytes, available, out, tok.length)
+
+        if consumed == 0:
+            raise ErlangTermDecodeError('Failed to uncompress compressed item')
+
+        d.offset += consumed
+        return inflated
+
+    cdef object _decode_node(self, erlpack_decoder *d, str what):
+        node = self._decode(d)
         if not isinstance(node, Atom):
-            raise ErlangTermDecodeError('Expected atom while parsing PID_EXT, found %r instead' % node)
-        pid_id, serial, creation = struct.unpack('>LLB', bytes[offset:offset + 9])
-        offset += 9
-        return PID(node, pid_id, serial, creation), offset
-
-    cdef object decode_q(self, bytes, offset):
-        """EXPORT_EXT"""
-        module, offset = self.decode_part(bytes, offset)
+            raise ErlangTermDecodeError('Expected atom while parsing %s, found %r instead' % (what, node))
+        return node
+
+    cdef object _decode_reference(self, erlpack_decoder *d):
+        cdef uint32_t reference_id = 0
+        cdef uint8_t creation = 0
+
+        node = self._decode_node(d, 'REFERENCE_EXT')
+        if erlpack_decoder_read32(d, &reference_id) < 0 or erlpack_decoder_read8(d, &creation) < 0:
+            self._fail(d)
+        return Reference(node, [reference_id], creation)
+
+    cdef object _decode_new_reference(self, erlpack_decoder *d, size_t id_len):
+        cdef uint8_t creation = 0
+        cdef uint32_t reference_id = 0
+        cdef tuple ids = PyTuple_New(id_len)
+        cdef size_t i
+        cdef object item
+
+        node = self._decode_node(d, 'NEW_REFERENCE_EXT')
+        if erlpack_decoder_read8(d, &creation) < 0:
+            self._fail(d)
+
+        for i in range(id_len):
+            if erlpack_decoder_read32(d, &reference_id) < 0:
+                self._fail(d)
+            item = PyLong_FromUnsignedLong(reference_id)
+            Py_INCREF(item)
+            PyTuple_SET_ITEM(ids, i, item)
+
+        return Reference(node, ids, creation)
+
+    cdef object _decode_port(self, erlpack_decoder *d):
+        cdef uint32_t port_id = 0
+        cdef uint8_t creation = 0
+
+        node = self._decode_node(d, 'PORT_EXT')
+        if erlpack_decoder_read32(d, &port_id) < 0 or erlpack_decoder_read8(d, &creation) < 0:
+            self._fail(d)
+        return Port(node, port_id, creation)
+
+    cdef object _decode_pid(self, erlpack_decoder *d):
+        cdef uint32_t pid_id = 0
+        cdef uint32_t serial = 0
+        cdef uint8_t creation = 0
+
+        node = self._decode_node(d, 'PID_EXT')
+        if (erlpack_decoder_read32(d, &pid_id) < 0 or erlpack_decoder_read32(d, &serial) < 0 or
+                erlpack_decoder_read8(d, &creation) < 0):
+            self._fail(d)
+        return PID(node, pid_id, serial, creation)
+
+    cdef object _decode_export(self, erlpack_decoder *d):
+        module = self._decode(d)
         if not isinstance(module, Atom):
             raise ErlangTermDecodeError('Expected atom while parsing EXPORT_EXT, found %r instead' % module)
-        function, offset = self.decode_part(bytes, offset)
+        function = self._decode(d)
         if not isinstance(function, Atom):
             raise ErlangTermDecodeError('Expected atom while parsing EXPORT_EXT, found %r instead' % function)
-        arity, offset = self.decode_part(bytes, offset)
+        arity = self._decode(d)
         if not isinstance(arity, int):
             raise ErlangTermDecodeError('Expected integer while parsing EXPORT_EXT, found %r instead' % arity)
-        return Export(module, function, arity), offset + 1
-
-    cdef object decode_P(self, bytes, offset):
-        """Compressed term"""
-        usize, = struct.unpack('>L', bytes[offset:offset + 4])
-        offset += 4
-        bytes = zlib.decompress(bytes[offset:offset + usize])
-        return self.decode_part(bytes, 0)
-
-    cdef object convert_atom(self, atom, encoding='latin1'):
-        """Convert an atom (bytes) into an appropriate Python object,
-        using specified encoding. The default encoding is latin1, which
-        is the old-style encoding."""
-        if atom == b'true':
-            return True
-        elif atom == b'false':
-            return False
-        elif atom == b'nil':
-            return None
-        return Atom(atom.decode(encoding))
+        return Export(module, function, arity)
+
+
+cdef class DecoderPool(object):
+    """
+    Hands out one ErlangTermDecoder per thread, each created on first use with the keyword arguments given here,
+    so threads decode without contending on a shared decoder's caches.
+    """
+    cdef dict _options
+    cdef object _local
+
+    def __init__(self, **options):
+        self._options = options
+        self._local = threading.local()
+        # Fails early on options the decoder does not accept.
+        self.get()
+
+    cpdef ErlangTermDecoder get(self):
+        """Returns the calling thread's decoder."""
+        cdef ErlangTermDecoder decoder = getattr(self._local, 'decoder', None)
+        if decoder is None:
+            decoder = ErlangTermDecoder(**self._options)
+            self._local.decoder = decoder
+
+        return decoder
+
+    def loads(self, object data, Py_ssize_t offset=0, paths=None, default=None):
+        cdef ErlangTermDecoder decoder = self.get()
+        if paths is not None:
+            return decoder._loads_paths(data, offset, paths, default)
+        return decoder._loads(data, offset, NULL)
+
+    def loads_with_offset(self, object data, Py_ssize_t offset=0):
+        return self.get().loads_with_offset(data, offset)
+
+    def iter_unpack(self, object data, Py_ssize_t offset=0):
+        return self.get().iter_unpack(data, offset)
+
+    def loads_lazy(self, object data, Py_ssize_t offset=0):
+        return self.get().loads_lazy(data, offset)
+
+
+cdef class TermIterator(object):
+    """
+    Decodes successive terms out of one buffer, see ErlangTermDecoder.iter_unpack. `offset` is where the next
+    term starts, so a stream cut off in the middle of a term can be resumed from there.
+    """
+    cdef ErlangTermDecoder decoder
+    cdef Py_buffer view
+    cdef bint holds_view
+    cdef erlpack_decoder dec
+    cdef object views
+
+    def __cinit__(self, ErlangTermDecoder decoder not None, data, Py_ssize_t offset=0):
+        PyObject_GetBuffer(data, &self.view, PyBUF_SIMPLE)
+        self.holds_view = True
+        if offset < 0 or offset > self.view.len:
+            raise ErlangTermDecodeError('Offset %d is outside of the buffer' % offset)
+
+        self.decoder = decoder
+        self.views = decoder._views_of(data)
+        erlpack_decoder_init(&self.dec, <const uint8_t *> self.view.buf, self.view.len)
+        _set_views(&self.dec, self.views)
+        self.dec.offset = offset
+
+    def __dealloc__(self):
+        self._release()
+
+    cdef void _release(self):
+        if self.holds_view:
+            self.holds_view = False
+            PyBuffer_Release(&self.view)
+
+    @property
+    def offset(self):
+        return self.dec.offset
+
+    def __iter__(self):
+        return self
+
+    def __next__(self):
+        cdef size_t start = self.dec.offset
+
+        if not self.holds_view or start >= self.dec.size:
+            self._release()
+            raise StopIteration
+
+        try:
+            return self.decoder._decode_term(&self.dec)
+        except:
+            # Leave `offset` at the start of the term that failed, and stop.
+            self.dec.offset = start
+            self._release()
+            raise
+
+
+cdef class Unpacker(object):
+    """
+    Decodes terms from a stream that arrives in chunks, framed the way Erlang's `{packet, N}` option frames
+    them: every term is prefixed with its length as a `packet` byte big-endian integer. Chunks are passed to
+    feed() as they arrive; iterating yields the terms of every complete frame and stops once the next one is
+    still partial.
+    """
+    cdef ErlangTermDecoder decoder
+    cdef erlpack_frames frames
+    cdef bint decoding
+
+    def __init__(self, int packet=4, ErlangTermDecoder decoder=None):
+        erlpack_frames_free(&self.frames)
+        if erlpack_frames_init(&self.frames, packet) < 0:
+            raise ValueError('packet must be 1, 2 or 4, not %d' % packet)
+
+        self.decoder = decoder if decoder is not None else ErlangTermDecoder()
+
+    def __dealloc__(self):
+        erlpack_frames_free(&self.frames)
+
+    @property
+    def pending(self):
+        """The number of bytes fed that are not part of a complete frame yet."""
+        return erlpack_frames_pending(&self.frames)
+
+    def feed(self, data):
+        cdef Py_buffer view
+
+        if self.decoding:
+            raise RuntimeError('Unpacker.feed() called while a frame is being decoded')
+
+        PyObject_GetBuffer(data, &view, PyBUF_SIMPLE)
+        try:
+            if erlpack_frames_feed(&self.frames, view.buf, view.len) < 0:
+                raise MemoryError
+        finally:
+            PyBuffer_Release(&view)
+
+    def __iter__(self):
+        return self
+
+    def __next__(self):
+        cdef const uint8_t *frame = NULL
+        cdef size_t length = 0
+        cdef erlpack_decoder dec
+        cdef object copy = None
+        cdef object views = None
+
+        if self.decoder is None:
+            raise TypeError('Unpacker.__init__() was not called')
+
+        if not erlpack_frames_next(&self.frames, &frame, &length):
+            raise StopIteration
+
+        # The frame is taken out of the buffer even when it fails to decode, so the stream stays aligned.
+        if length == 0:
+            raise ErlangTermDecodeError('Empty frame')
+
+        if self.decoder._binary_views:
+            # Binaries must not point into the buffer, which gets reused for the frames that follow.
+            copy = PyBytes_FromStringAndSize(<const char *> frame, length)
+            views = self.decoder._views_of(copy)
+            frame = <const uint8_t *> PyBytes_AS_STRING(copy)
+
+        erlpack_decoder_init(&dec, frame, length)
+        _set_views(&dec, views)
+        self.decoding = True
+        try:
+            term = self.decoder._decode_term(&dec)
+        finally:
+            self.decoding = False
+
+        if dec.offset != length:
+            raise ErlangTermDecodeError('Frame holds %d bytes after its term' % (length - dec.offset))
+        return term
+
+
+cdef class PathNode(object):
+    """A trie of the paths a projected decode looks for, so paths sharing a prefix walk it once."""
+    cdef list keys
+    cdef list elements
+    cdef list children
+    cdef list leaves
+    cdef Py_ssize_t pending
+
+    def __cinit__(self):
+        self.keys = []
+        self.elements = []
+        self.children = []
+        self.leaves = []
+
+    @staticmethod
+    cdef PathNode build(paths):
+        cdef PathNode root = PathNode()
+        cdef PathNode node
+        cdef Py_ssize_t index = 0
+
+        for path in paths:
+            if isinstance(path, (unicode, bytes, int)):
+                path = (path,)
+
+            node = root
+            for element in path:
+                node = node.child(element)
+            node.leaves.append(index)
+            index += 1
+
+        root.count()
+        return root
+
+    cdef PathNode child(self, element):
+        cdef PathNode node
+
+        if isinstance(element, unicode):
+            key = (<unicode> element).encode('utf-8')
+        elif isinstance(element, (bytes, int)):
+            key = element
+        else:
+            raise TypeError('Path elements are map keys or indexes (str, bytes or int), not %r' % (element,))
+
+        for i, existing in enumerate(self.keys):
+            if type(existing) is type(key) and existing == key:
+                return self.children[i]
+
+        node = PathNode()
+        self.keys.append(key)
+        self.elements.append(element)
+        self.children.append(node)
+        return node
+
+    cdef Py_ssize_t count(self):
+        cdef PathNode child
+        self.pending = len(self.leaves)
+        for child in self.children:
+            self.pending += child.count()
+        return self.pending
+
+    cdef PathNode match_bytes(self, const char *data, size_t length):
+        for i, key in enumerate(self.keys):
+            if (type(key) is bytes and <size_t> PyBytes_GET_SIZE(key) == length and
+                    memcmp(PyBytes_AS_STRING(key), data, length) == 0):
+                return self.children[i]
+        return None
+
+    cdef PathNode match_int(self, int64_t value):
+        for i, key in enumerate(self.keys):
+            if type(key) is int and key == value:
+                return self.children[i]
+        return None
+
+    cdef PathNode match_index(self, size_t index):
+        return self.match_int(index)
+
+    cdef resolve_decoded(self, value, list results):
+        """
+        Resolves the paths that go on past a value that was decoded whole, such as `d` and `d.id`. A negative
+        integer only ever matches a map key, as it does when the term is walked, and never counts from the end
+        of a list.
+        """
+        cdef PathNode child
+
+        for i, child in enumerate(self.children):
+            sub = _MISSING
+            if isinstance(value, dict):
+                sub = value.get(self.elements[i], _MISSING)
+                if sub is _MISSING:
+                    sub = value.get(self.keys[i], _MISSING)
+            elif isinstance(value, (list, tuple)) and type(self.keys[i]) is int and self.keys[i] >= 0:
+                try:
+                    sub = value[self.keys[i]]
+                except IndexError:
+                    pass
+
+            if sub is _MISSING:
+                continue
+            for j in child.leaves:
+                results[j] = sub
+            child.resolve_decoded(sub, results)
+
+
+cdef object _MISSING = object()
+
+
+cdef class LazySource(object):
+    """The buffer lazy proxies decode from, held for as long as any of them is alive."""
+    cdef ErlangTermDecoder decoder
+    cdef Py_buffer view
+    cdef bint holds_view
+    cdef object views
+
+    def __cinit__(self, ErlangTermDecoder decoder not None, data):
+        PyObject_GetBuffer(data, &self.view, PyBUF_SIMPLE)
+        self.holds_view = True
+        self.decoder = decoder
+        self.views = decoder._views_of(data)
+
+    def __dealloc__(self):
+        if self.holds_view:
+            PyBuffer_Release(&self.view)
+
+    cdef void init_decoder(self, erlpack_decoder *d, size_t offset):
+        erlpack_decoder_init(d, <const uint8_t *> self.view.buf, self.view.len)
+        _set_views(d, self.views)
+        d.offset = offset
+
+    cdef object decode_at(self, size_t offset):
+        cdef erlpack_decoder dec
+        self.init_decoder(&dec, offset)
+        return self.decode(&dec)
+
+    cdef object decode(self, erlpack_decoder *d):
+        """Decodes the term at `d`, as a proxy when it is a map or a list. Leaves `d` anywhere past its start."""
+        cdef erlpack_token tok
+        cdef size_t start = d.offset
+        cdef LazyMap lazy_map
+        cdef LazyList lazy_list
+
+        if erlpack_decoder_next(d, &tok) < 0:
+            self.decoder._fail(d)
+
+        if tok.type == ERLPACK_TOKEN_MAP:
+            self.decoder._check_arity(d, tok.length, 2)
+            lazy_map = LazyMap.__new__(LazyMap)
+            lazy_map._source = self
+            lazy_map._offset = d.offset
+            lazy_map._length = tok.length
+            return lazy_map
+
+        elif tok.type == ERLPACK_TOKEN_LIST:
+            self.decoder._check_arity(d, tok.length, 1)
+            lazy_list = LazyList.__new__(LazyList)
+            lazy_list._source = self
+            lazy_list._offset = d.offset
+            lazy_list._length = tok.length
+            return lazy_list
+
+        elif tok.type == ERLPACK_TOKEN_COMPRESSED:
+            return LazySource(self.decoder, self.decoder._inflate(d, &tok)).decode_at(0)
+
+        d.offset = start
+        return self.decoder._decode(d)
+
+
+cdef object _materialize(value):
+    if isinstance(value, (LazyMap, LazyList)):
+        return value.materialize()
+    return value
+
+
+cdef class LazyMap(object):
+    """
+    A decoded map whose values are decoded the first time they are read. All of the keys are decoded the first
+    time the map is used, the values in between are skipped over.
+    """
+    cdef LazySource _source
+    cdef size_t _offset
+    cdef size_t _length
+    cdef dict _offsets
+    cdef dict _values
+
+    cdef int _index(self) except -1:
+        cdef erlpack_decoder dec
+        cdef ErlangTermDecoder decoder = self._source.decoder
+        cdef dict offsets
+        cdef size_t i
+
+        # Lazy terms can be shared between threads. Without the critical section another reader could
+        # see `_offsets` set while `_values` is still None.
+        with cython.critical_section(self):
+            if self._offsets is not None:
+                return 0
+
+            offsets = _PyDict_NewPresized(self._length)
+            self._source.init_decoder(&dec, self._offset)
+            for i in range(self._length):
+                key = decoder._decode_key(&dec)
+                offsets[key] = dec.offset
+                if erlpack_decoder_skip(&dec) < 0:
+                    decoder._fail(&dec)
+
+            self._offsets = offsets
+            self._values = {}
+            return 0
+
+    def __getitem__(self, key):
+        self._index()
+        value = self._values.get(key, _MISSING)
+        if value is _MISSING:
+            value = self._source.decode_at(self._offsets[key])
+            self._values[key] = value
+        return value
+
+    def get(self, key, default=None):
+        self._index()
+        if key in self._offsets:
+            return self[key]
+        return default
+
+    def __contains__(self, key):
+        self._index()
+        return key in self._offsets
+
+    def __len__(self):
+        self._index()
+        return len(self._offsets)
+
+    def __iter__(self):
+        self._index()
+        return iter(self._offsets)
+
+    def keys(self):
+        self._index()
+        return self._offsets.keys()
+
+    def values(self):
+        return [self[key] for key in self.keys()]
+
+    def items(self):
+        return [(key, self[key]) for key in self.keys()]
+
+    def materialize(self):
+        """Returns the whole map as a dict, decoding whatever was not read yet."""
+        cdef erlpack_decoder dec
+        cdef dict result = {}
+
+        self._index()
+        for key, offset in self._offsets.items():
+            value = self._values.get(key, _MISSING)
+            if value is _MISSING:
+                self._source.init_decoder(&dec, offset)
+                value = self._source.decoder._decode(&dec)
+            result[key] = _materialize(value)
+        return result
+
+    def __eq__(self, other):
+        return self.materialize() == _materialize(other)
+
+    def __repr__(self):
+        return 'LazyMap(%r)' % (self.materialize(),)
+
+
+cdef class LazyList(object):
+    """
+    A decoded list whose elements are decoded the first time they are read. Finding an element skips over
+    the ones before it, once.
+    """
+    cdef LazySource _source
+    cdef size_t _offset
+    cdef size_t _length
+    cdef size_t *_offsets
+    cdef list _values
+
+    def __dealloc__(self):
+        free(self._offsets)
+
+    cdef int _index(self) except -1:
+        cdef erlpack_decoder dec
+        cdef ErlangTermDecoder decoder = self._source.decoder
+        cdef size_t *offsets
+        cdef size_t i
+
+        # Two readers building the index at once would each malloc offsets and one would be leaked.
+        with cython.critical_section(self):
+            if self._values is not None:
+                return 0
+
+            offsets = <size_t *> malloc(max(self._length, <size_t> 1) * sizeof(size_t))
+            if offsets == NULL:
+                raise MemoryError
+
+            self._source.init_decoder(&dec, self._offset)
+            for i in range(self._length):
+                offsets[i] = dec.offset
+                if erlpack_decoder_skip(&dec) < 0:
+                    free(offsets)
+                    decoder._fail(&dec)
+
+            if dec.offset < dec.size and dec.data[dec.offset] != NIL_EXT:
+                free(offsets)
+                raise NotImplementedError('Lists with non empty tails are not supported')
+
+            self._offsets = offsets
+            self._values = [_MISSING] * <Py_ssize_t> self._length
+            return 0
+
+    cdef object _item(self, size_t i):
+        value = self._values[i]
+        if value is _MISSING:
+            value = self._source.decode_at(self._offsets[i])
+            self._values[i] = value
+        return value
+
+    def __getitem__(self, index):
+        self._index()
+        if isinstance(index, slice):
+            return [self._item(i) for i in range(*index.indices(self._length))]
+
+        cdef Py_ssize_t i = index
+        if i < 0:
+            i += self._length
+        if i < 0 or <size_t> i >= self._length:
+            raise IndexError('list index out of range')
+        return self._item(i)
+
+    def __len__(self):
+        return self._length
+
+    def __iter__(self):
+        cdef size_t i
+        self._index()
+        for i in range(self._length):
+            yield self._item(i)
+
+    def materialize(self):
+        """Returns the whole list, decoding whatever was not read yet."""
+        cdef erlpack_decoder dec
+        cdef list result = PyList_New(0)
+        cdef size_t i
+
+        self._index()
+        for i in range(self._length):
+            value = self._values[i]
+            if value is _MISSING:
+                self._source.init_decoder(&dec, self._offsets[i])
+                value = self._source.decoder._decode(&dec)
+            result.append(_materialize(value))
+        return result
+
+    def __eq__(self, other):
+        return self.materialize() == _materialize(other)
+
+    def __repr__(self):
+        return 'LazyList(%r)' % (self.materialize(),)
+
+
+Mapping.register(LazyMap)
+Sequence.register(LazyList)
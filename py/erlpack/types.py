@@ -5,10 +5,13 @@ Types based on work from Samuel Stauffer's `python-erlastic` library. See COPYIN
 import six
 
 
-__all__ = ['Atom', 'Reference', 'Port', 'PID', 'Export']
+__all__ = ['Atom', 'Reference', 'Port', 'PID', 'Export', 'MapStream']
 
 
 class Atom(six.text_type):
+    # Decoders hand out the same Atom for every occurrence of an atom, so atoms carry no state of their own.
+    __slots__ = ()
+
     def __repr__(self):
         return 'Atom(%s)' % super(Atom, self).__repr__()
 
@@ -103,3 +106,14 @@ class Export(object):
 
     def __repr__(self):
         return str(self)
+
+
+class MapStream(object):
+    """Packs an iterable of (key, value) pairs as a map, consuming it as it is encoded instead of building a dict."""
+    __slots__ = ['items']
+
+    def __init__(self, items):
+        self.items = items
+
+    def __repr__(self):
+        return 'MapStream(%r)' % (self.items,)
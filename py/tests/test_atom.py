@@ -1,6 +1,8 @@
 from __future__ import absolute_import
+import sys
+
 from erlpack.types import Atom
-from erlpack import pack
+from erlpack import ErlangTermEncoder, pack
 
 
 def test_small_atom():
@@ -18,3 +20,34 @@ def test_large_atom():
         b'test test test test test test test test test test test test test test test test test test test test test '
         b'test test test test test test test test test test test test test test test test test test '
     )
+
+
+def test_cached_atoms():
+    ok = Atom('ok')
+    encoder = ErlangTermEncoder(atom_cache_size=1)
+    expected = b'\x83h\x03s\x02oks\x02oks\x02ok'
+
+    assert encoder.pack((ok, ok, Atom('ok'))) == expected
+    assert encoder.pack((ok, ok, Atom('ok'))) == expected
+    assert encoder.pack([Atom('a'), Atom('b'), ok]) == b'\x83l\x00\x00\x00\x03s\x01as\x01bs\x02okj'
+
+
+def test_atom_cache_disabled():
+    ok = Atom('ok')
+    encoder = ErlangTermEncoder(atom_cache_size=0)
+    assert encoder.pack([ok, ok]) == b'\x83l\x00\x00\x00\x02s\x02oks\x02okj'
+
+
+
+def test_atom_cache_is_keyed_by_name():
+    encoder = ErlangTermEncoder(atom_cache_size=2)
+    names = [u'atom_%d' % i for i in range(50)]
+    for _ in range(2):
+        for name in names:
+            assert encoder.pack(Atom(name)) == b'\x83s' + bytes(bytearray([len(name)])) + name.encode('latin-1')
+
+    # The cache keeps the encoded name, not the object it came from.
+    ok = Atom('ok')
+    refs = sys.getrefcount(ok)
+    encoder.pack(ok)
+    assert sys.getrefcount(ok) == refs
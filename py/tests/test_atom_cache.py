@@ -0,0 +1,70 @@
+from __future__ import absolute_import
+import gc
+
+from erlpack import Atom, ErlangTermDecoder, pack
+
+
+def test_atoms_are_interned():
+    decoder = ErlangTermDecoder()
+    first = decoder.loads(pack(Atom('ready')))
+    second = decoder.loads(pack([Atom('ready'), Atom('ready')]))
+
+    assert first == Atom('ready')
+    assert second[0] is first
+    assert second[1] is first
+
+
+def test_latin1_and_utf8_atoms_are_interned_apart():
+    decoder = ErlangTermDecoder()
+    latin1 = decoder.loads(b'\x83s\x02ok')
+    utf8 = decoder.loads(b'\x83w\x02ok')
+
+    assert latin1 == utf8 == Atom('ok')
+    assert decoder.loads(b'\x83s\x02ok') is latin1
+    assert decoder.loads(b'\x83w\x02ok') is utf8
+
+
+def test_atom_cache_can_be_disabled():
+    decoder = ErlangTermDecoder(atom_cache_size=0)
+    first, second = decoder.loads(pack([Atom('ready'), Atom('ready')]))
+    assert first == second
+    assert first is not second
+
+
+def test_atom_cache_evicts():
+    decoder = ErlangTermDecoder(atom_cache_size=4)
+    names = [u'atom_%d' % i for i in range(100)]
+
+    for _ in range(3):
+        assert decoder.loads(pack([Atom(name) for name in names])) == names
+
+    del decoder
+    gc.collect()
+
+
+def test_map_keys_are_deduplicated():
+    decoder = ErlangTermDecoder(encoding='utf-8')
+    members = decoder.loads(pack([{'id': 1, 'guild_id': 2}, {'id': 3, 'guild_id': 4}]))
+    first, second = [list(member) for member in members]
+
+    assert members == [{u'id': 1, u'guild_id': 2}, {u'id': 3, u'guild_id': 4}]
+    assert first[0] is second[0]
+    assert first[1] is second[1]
+
+
+def test_map_key_cache_without_encoding():
+    decoder = ErlangTermDecoder()
+    first, second = decoder.loads(pack([{'id': 1}, {'id': 2}]))
+    assert list(first)[0] is list(second)[0] == b'id'
+
+
+def test_map_key_cache_can_be_disabled():
+    decoder = ErlangTermDecoder(key_cache_size=0)
+    first, second = decoder.loads(pack([{'id': 1}, {'id': 2}]))
+    assert list(first)[0] is not list(second)[0]
+
+
+def test_only_map_keys_are_deduplicated():
+    decoder = ErlangTermDecoder(encoding='utf-8')
+    first, second = decoder.loads(pack([{'key': 'value'}, {'key': 'value'}]))
+    assert first[u'key'] is not second[u'key']
@@ -0,0 +1,62 @@
+from __future__ import absolute_import
+import pytest
+
+from erlpack import ErlangTermDecoder, ErlangTermEncoder, Unpacker, pack
+
+BLOB = bytes(bytearray(range(256))) * 100
+TERM = {'blob': BLOB, 'parts': [b'a', (b'bc', 1)], b'k' * 100: 2}
+
+
+def decoder():
+    return ErlangTermDecoder(binary_mode='memoryview')
+
+
+def test_binaries_are_views_of_the_input():
+    packed = pack(TERM)
+    decoded = decoder().loads(packed)
+
+    blob = decoded[b'blob']
+    assert isinstance(blob, memoryview)
+    assert blob.readonly
+    assert blob.obj is packed
+    assert blob == BLOB
+    assert decoded[b'parts'][0] == b'a'
+    assert decoded[b'parts'][1][0] == b'bc'
+
+    # Keys stay bytes, long ones included.
+    assert set(decoded) == {b'blob', b'parts', b'k' * 100}
+
+
+def test_views_of_other_buffers():
+    packed = bytearray(pack(TERM))
+    blob = decoder().loads(memoryview(packed))[b'blob']
+    assert blob.readonly
+    assert blob == BLOB
+    with pytest.raises(BufferError):
+        packed.extend(b'x')
+
+
+def test_views_everywhere():
+    packed = pack(TERM)
+    assert isinstance(decoder().loads(packed, paths=[b'blob'])[0], memoryview)
+    assert isinstance(decoder().loads_lazy(packed)[b'blob'], memoryview)
+    assert isinstance(next(decoder().iter_unpack(packed))[b'blob'], memoryview)
+
+    compressed = ErlangTermEncoder(compressed=True, compress_threshold=0).pack(TERM)
+    assert decoder().loads(compressed)[b'blob'] == BLOB
+
+
+def test_unpacker_views_outlive_the_frame():
+    packed = pack(TERM)
+    unpacker = Unpacker(packet=4, decoder=decoder())
+    unpacker.feed(len(packed).to_bytes(4, 'big') + packed)
+    blob = next(unpacker)[b'blob']
+    unpacker.feed(len(packed).to_bytes(4, 'big') + pack({'blob': b'x' * len(BLOB)}))
+    assert blob == BLOB
+
+
+def test_binary_mode_checks():
+    with pytest.raises(ValueError):
+        ErlangTermDecoder(binary_mode='str')
+    with pytest.raises(ValueError):
+        ErlangTermDecoder(encoding='utf-8', binary_mode='memoryview')
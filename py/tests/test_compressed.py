@@ -0,0 +1,67 @@
+from __future__ import absolute_import
+import os
+import threading
+import zlib
+
+import pytest
+
+from erlpack import ErlangTermEncoder, pack, unpack
+from erlpack._unpacker import ErlangTermDecodeError
+
+
+def test_compressed():
+    obj = {'a': ['hello world'] * 100}
+    packed = ErlangTermEncoder(compressed=True, compress_threshold=10).pack(obj)
+    uncompressed = pack(obj)
+
+    assert packed[:2] == b'\x83P'
+    assert packed[2:6] == b'\x00\x00\x06\x51'
+    assert zlib.decompress(packed[6:]) == uncompressed[1:]
+    assert unpack(packed) == {b'a': [b'hello world'] * 100}
+
+
+def test_compressed_below_threshold():
+    encoder = ErlangTermEncoder(compressed=True)
+    assert encoder.pack([1, 'two']) == pack([1, 'two'])
+
+
+def test_compressed_incompressible():
+    blob = os.urandom(4096)
+    encoder = ErlangTermEncoder(compressed=True, compress_threshold=0)
+    assert encoder.pack(blob) == pack(blob)
+
+
+def test_compress_level():
+    obj = [u'x' * 2000, u'y' * 2000]
+    assert unpack(ErlangTermEncoder(compressed=True, compress_level=9).pack(obj)) == [b'x' * 2000, b'y' * 2000]
+
+    with pytest.raises(ValueError):
+        ErlangTermEncoder(compress_level=10)
+
+
+def test_compressed_impossible_size():
+    # Two bytes of zlib cannot inflate to 4 GB; refuse before allocating it.
+    data = b'\x83P\xff\xff\xff\xf0' + zlib.compress(b'')
+    with pytest.raises(ErlangTermDecodeError):
+        unpack(data)
+
+
+def test_compressed_large_from_threads():
+    obj = {'state': [{'id': i, 'name': 'member %d' % i} for i in range(20000)]}
+    packed = ErlangTermEncoder(compressed=True).pack(obj)
+    expected = unpack(packed)
+    assert len(expected[b'state']) == 20000
+
+    results = []
+
+    def decode():
+        for _ in range(5):
+            results.append(unpack(packed) == expected)
+
+    threads = [threading.Thread(target=decode) for _ in range(4)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+    assert results == [True] * 20
@@ -0,0 +1,40 @@
+from __future__ import absolute_import
+from collections import namedtuple
+
+from erlpack import Atom, ErlangTermDecoder, pack
+
+User = namedtuple('User', ['id', 'name'])
+
+
+def test_object_hook():
+    decoder = ErlangTermDecoder(encoding='utf-8', object_hook=lambda d: sorted(d.items()))
+    assert decoder.loads(pack({'b': {'c': 1}, 'a': 2})) == [(u'a', 2), (u'b', [(u'c', 1)])]
+
+
+def test_tuple_hook():
+    decoder = ErlangTermDecoder(tuple_hook=list)
+    assert decoder.loads(pack((1, (2, 3), [(4,)]))) == [1, [2, 3], [[4]]]
+
+
+def test_record_factories():
+    decoder = ErlangTermDecoder(encoding='utf-8', record_factories={'user': User}, tuple_hook=list)
+    decoded = decoder.loads(pack([(Atom('user'), 1, 'alice'), (Atom('other'), 2), ('user', 3)]))
+    assert decoded == [User(1, u'alice'), [Atom('other'), 2], [u'user', 3]]
+    assert isinstance(decoded[0], User)
+
+
+def test_hooks_apply_innermost_first():
+    seen = []
+
+    def hook(d):
+        seen.append(dict(d))
+        return len(d)
+
+    decoder = ErlangTermDecoder(encoding='utf-8', object_hook=hook)
+    assert decoder.loads(pack({'outer': {'inner': 1, 'other': 2}})) == 1
+    assert seen == [{u'inner': 1, u'other': 2}, {u'outer': 2}]
+
+
+def test_hooks_apply_to_paths():
+    decoder = ErlangTermDecoder(encoding='utf-8', record_factories={'user': User})
+    assert decoder.loads(pack({'d': (Atom('user'), 1, 'bob')}), paths=[('d',)]) == (User(1, u'bob'),)
@@ -17,3 +17,26 @@ def test_encode_hook():
 
     with raises(NotImplementedError):
         encoder.pack(datetime.date.today())
+
+
+def test_classes_modified_after_packing():
+    class Point(object):
+        def __init__(self, x, y):
+            self.x = x
+            self.y = y
+
+    encoder = ErlangTermEncoder(encode_hook=lambda obj: [obj.x, obj.y])
+    assert encoder.pack([Point(1, 2), Point(3, 4)]) == encoder.pack([[1, 2], [3, 4]])
+
+    Point.__erlpack__ = lambda self: (self.x, self.y)
+    assert encoder.pack(Point(1, 2)) == encoder.pack((1, 2))
+
+    del Point.__erlpack__
+    assert encoder.pack(Point(1, 2)) == encoder.pack([1, 2])
+
+
+def test_many_types():
+    encoder = ErlangTermEncoder(encode_hook=lambda obj: obj.value)
+    classes = [type('T%d' % i, (object,), {'__init__': lambda self, v: setattr(self, 'value', v)}) for i in range(300)]
+    for _ in range(2):
+        assert encoder.pack([cls(i) for i, cls in enumerate(classes)]) == encoder.pack(list(range(300)))
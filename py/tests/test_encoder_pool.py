@@ -0,0 +1,108 @@
+from __future__ import absolute_import
+import threading
+
+import pytest
+
+from erlpack import EncoderPool, ErlangTermEncoder, MapStream, pack
+
+MB = 1024 * 1024
+
+
+def stream(size):
+    # Map streams cannot be sized up front, so they are encoded in the retained buffer.
+    return MapStream(iter([('blob', b'x' * size)]))
+
+
+def test_buffer_is_reused():
+    encoder = ErlangTermEncoder()
+    for _ in range(3):
+        encoder.pack(stream(10))
+
+    assert encoder.buffer_stats == {'allocated': 1, 'reused': 2, 'released': 0, 'direct': 0, 'retained': MB}
+
+
+def test_sized_terms_do_not_touch_the_buffer():
+    encoder = ErlangTermEncoder()
+    encoder.pack({'a': 1})
+    encoder.pack({'blob': b'x' * 3 * MB})
+    encoder.pack_into({'a': 1}, bytearray(16))
+    assert encoder.buffer_stats == {'allocated': 0, 'reused': 0, 'released': 0, 'direct': 3, 'retained': 0}
+
+
+def test_large_buffers_are_released():
+    encoder = ErlangTermEncoder()
+    encoder.pack(stream(3 * MB))
+    encoder.pack(stream(3 * MB))
+    stats = encoder.buffer_stats
+    assert (stats['allocated'], stats['released'], stats['retained']) == (2, 2, 0)
+
+
+def test_max_buffer_size():
+    encoder = ErlangTermEncoder(max_buffer_size=16 * MB)
+    encoder.pack(stream(3 * MB))
+    encoder.pack(stream(3 * MB))
+    stats = encoder.buffer_stats
+    assert (stats['allocated'], stats['reused'], stats['released']) == (1, 1, 0)
+    assert stats['retained'] > 3 * MB
+
+
+def test_buffer_decay():
+    encoder = ErlangTermEncoder(max_buffer_size=16 * MB, buffer_decay=3)
+    encoder.pack(stream(3 * MB))
+    encoder.pack(stream(10))
+    encoder.pack(stream(10))
+    encoder.pack(stream(3 * MB))  # Busy again, so the count starts over.
+    encoder.pack(stream(10))
+    encoder.pack(stream(10))
+    assert encoder.buffer_stats['released'] == 0
+
+    encoder.pack(stream(10))
+    assert encoder.buffer_stats['released'] == 1
+    assert encoder.buffer_stats['retained'] == 0
+
+
+def test_pool_hands_out_one_encoder_per_thread():
+    pool = EncoderPool(encoding='utf-8')
+    assert pool.get() is pool.get()
+
+    others = []
+    thread = threading.Thread(target=lambda: others.append(pool.get()))
+    thread.start()
+    thread.join()
+    assert others[0] is not pool.get()
+
+
+def test_pool_packs_from_threads():
+    pool = EncoderPool()
+    expected = pack({'a': [1, 2, 3]})
+    results = []
+
+    def work():
+        for _ in range(100):
+            results.append(pool.pack(MapStream(iter([('a', [1, 2, 3])]))) == expected)
+
+    threads = [threading.Thread(target=work) for _ in range(4)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+    assert results == [True] * 400
+    del threads, thread
+    assert pool.stats()['encoders'] >= 1
+
+
+def test_pool_stats():
+    pool = EncoderPool()
+    pool.pack(stream(10))
+    pool.pack(stream(10))
+    stats = pool.stats()
+    assert stats == {'encoders': 1, 'allocated': 1, 'reused': 1, 'released': 0, 'direct': 0, 'retained': MB}
+
+    pool.pack({'a': 1})
+    assert pool.stats()['direct'] == 1
+
+
+def test_pool_rejects_bad_options():
+    with pytest.raises(TypeError):
+        EncoderPool(not_an_option=True)
@@ -22,3 +22,26 @@ def test_erlpack_magic_method():
     # Could be packed in either order
     assert packed == b'\x83t\x00\x00\x00\x02s\x03agea\x17s\x04namem\x00\x00\x00\x04jake' \
         or packed == b'\x83t\x00\x00\x00\x02s\x04namem\x00\x00\x00\x04jakes\x03agea\x17'
+
+
+class Proxy(object):
+    def __init__(self, target):
+        self._target = target
+
+    def __getattr__(self, name):
+        return getattr(self._target, name)
+
+
+def test_erlpack_magic_method_on_instance():
+    u = User('jake', 23)
+    packed = pack(u)
+
+    # Neither is found on the type, only on the instance.
+    assert pack(Proxy(u)) == packed
+
+    class Plain(object):
+        pass
+
+    p = Plain()
+    p.__erlpack__ = u.__erlpack__
+    assert pack(p) == packed
@@ -0,0 +1,24 @@
+from __future__ import absolute_import
+from erlpack import Atom, ErlangTermEncoder, pack
+
+
+def test_sized_and_buffered_output_match():
+    obj = {
+        'a': [1, 255, 256, -1, 2 ** 31, -2 ** 40, 2 ** 64 - 1, 1.5],
+        Atom('b'): (True, False, None, Atom('x' * 300)),
+        'c': [u'été', b'bytes', {}, [], ()],
+        'd': tuple(range(300)),
+    }
+
+    # A hook makes every value unsizable, which forces the buffered path.
+    buffered = ErlangTermEncoder(encode_hook=lambda o: o).pack(obj)
+    assert pack(obj) == buffered
+
+
+def test_unsizable_terms_fall_back():
+    class Thing(object):
+        def __erlpack__(self):
+            return [1, 2, 3]
+
+    assert pack({'thing': Thing()}) == pack({'thing': [1, 2, 3]})
+    assert ErlangTermEncoder(encoding='latin-1').pack(u'é') == b'\x83m\x00\x00\x00\x01\xe9'
@@ -0,0 +1,36 @@
+from __future__ import absolute_import
+import pytest
+
+from erlpack import Atom, ErlangTermEncoder, Fragment, pack, unpack
+
+
+def test_fragment_packs_as_its_value():
+    value = {u'op': 0, u'd': [Atom('ready'), (1, 2.5)]}
+    fragment = Fragment(value)
+
+    assert fragment.encoded == pack(value)[1:]
+    assert pack(fragment) == pack(value)
+    assert pack([fragment, fragment]) == pack([value, value])
+
+
+def test_fragment_as_map_key():
+    op = Fragment(u'op')
+    assert pack({op: 10, u'd': None}) == pack({u'op': 10, u'd': None})
+    assert unpack(pack({op: 10})) == {b'op': 10}
+
+
+def test_fragment_uses_encoder_options():
+    fragment = Fragment(u'abc', ErlangTermEncoder(unicode_type=b'str'))
+    assert fragment.encoded == b'k\x00\x03abc'
+
+
+def test_fragment_is_never_compressed():
+    value = [u'hello world'] * 100
+    encoder = ErlangTermEncoder(compressed=True, compress_threshold=10)
+    assert Fragment(value, encoder).encoded == pack(value)[1:]
+
+
+def test_fragment_is_read_only():
+    fragment = Fragment(1)
+    with pytest.raises(AttributeError):
+        fragment.encoded = b'a\x02'
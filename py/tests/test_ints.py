@@ -1,5 +1,5 @@
 from __future__ import absolute_import
-from erlpack import pack
+from erlpack import pack, unpack
 from pytest import raises
 from six.moves import range
 
@@ -28,5 +28,13 @@ def test_long_long():
 
 
 def test_really_big_ints():
-    with raises(OverflowError):
-        pack(123094182304912341123414)
+    assert pack(123094182304912341123414) == b'\x83n\x0a\x00V\xc1~\x82cA\xf1\xf2\x10\x1a'
+    assert pack(-(2 ** 64 - 1)) == b'\x83n\x08\x01' + b'\xff' * 8
+    assert pack(2 ** 2039) == b'\x83n\xff\x00' + b'\x00' * 254 + b'\x80'
+    assert pack(-2 ** 2048) == b'\x83o\x00\x00\x01\x01\x01' + b'\x00' * 256 + b'\x01'
+
+
+def test_big_ints_round_trip():
+    for value in (2 ** 64, -(2 ** 63) - 1, 2 ** 127 + 5, -(2 ** 128 - 1), 3 ** 5000, -(7 ** 3000)):
+        assert unpack(pack(value)) == value
+        assert unpack(pack([value, {value: value}])) == [value, {value: value}]
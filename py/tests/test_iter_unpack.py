@@ -0,0 +1,45 @@
+from __future__ import absolute_import
+import pytest
+
+from erlpack import ErlangTermDecoder, iter_unpack, pack
+from erlpack._unpacker import ErlangTermDecodeError
+
+TERMS = [1, u'two', [3, (4, 5)], {u'six': None}, 2 ** 100]
+
+
+def test_loads_with_offset():
+    first, second = pack(TERMS[0]), pack(TERMS[1])
+    decoder = ErlangTermDecoder(encoding='utf-8')
+
+    assert decoder.loads_with_offset(first + second) == (1, len(first))
+    assert decoder.loads_with_offset(first + second, len(first)) == (u'two', len(first) + len(second))
+
+
+def test_iter_unpack():
+    stream = b''.join(pack(term) for term in TERMS)
+    decoded = list(ErlangTermDecoder(encoding='utf-8').iter_unpack(stream))
+    assert decoded == TERMS
+
+    assert list(iter_unpack(memoryview(b'xx' + stream)[2:])) == list(iter_unpack(stream))
+    assert list(iter_unpack(stream, len(stream))) == []
+
+
+def test_iter_unpack_stops_at_a_truncated_term():
+    complete = pack(TERMS[0]) + pack(TERMS[2])
+    terms = iter_unpack(complete + pack(TERMS[3])[:-2])
+
+    assert next(terms) == TERMS[0]
+    assert next(terms) == TERMS[2]
+    with pytest.raises(ErlangTermDecodeError):
+        next(terms)
+
+    # The offset is left where the broken term starts, so it can be resumed once the rest arrives.
+    assert terms.offset == len(complete)
+    with pytest.raises(StopIteration):
+        next(terms)
+
+
+def test_iter_unpack_releases_the_buffer():
+    data = bytearray(pack(1) + pack(2))
+    assert list(iter_unpack(data)) == [1, 2]
+    data.extend(pack(3))
@@ -0,0 +1,76 @@
+from __future__ import absolute_import
+from collections.abc import Mapping, Sequence
+import pytest
+
+from erlpack import Atom, ErlangTermDecoder, ErlangTermEncoder, LazyList, LazyMap, pack, unpack_lazy
+
+MESSAGE = {
+    u'op': 0,
+    u't': Atom('MESSAGE_CREATE'),
+    u'd': {u'id': u'1234', u'content': u'x' * 1000, u'mentions': [{u'id': i} for i in range(100)]},
+    u's': (1, 2.5, None),
+}
+
+
+def decoder():
+    return ErlangTermDecoder(encoding='utf-8')
+
+
+def test_lazy_map_reads_single_fields():
+    message = decoder().loads_lazy(pack(MESSAGE))
+
+    assert isinstance(message, LazyMap)
+    assert isinstance(message, Mapping)
+    assert message[u'op'] == 0
+    assert message[u't'] == Atom('MESSAGE_CREATE')
+    assert message[u'd'][u'id'] == u'1234'
+    assert message[u'd'][u'mentions'][-1][u'id'] == 99
+    assert message[u's'] == (1, 2.5, None)
+    assert message.get(u'missing') is None
+    assert u'd' in message
+    assert len(message) == 4
+    with pytest.raises(KeyError):
+        message[u'missing']
+
+
+def test_lazy_values_are_decoded_once():
+    message = decoder().loads_lazy(pack(MESSAGE))
+    assert message[u'd'] is message[u'd']
+    assert message[u'd'][u'mentions'][0] is message[u'd'][u'mentions'][0]
+
+
+def test_lazy_list():
+    mentions = decoder().loads_lazy(pack(MESSAGE))[u'd'][u'mentions']
+
+    assert isinstance(mentions, LazyList)
+    assert isinstance(mentions, Sequence)
+    assert len(mentions) == 100
+    assert [m[u'id'] for m in mentions[10:13]] == [10, 11, 12]
+    assert [m[u'id'] for m in mentions][-3:] == [97, 98, 99]
+    with pytest.raises(IndexError):
+        mentions[100]
+
+
+def test_lazy_materialize():
+    message = decoder().loads_lazy(pack(MESSAGE))
+    message[u'd'][u'mentions'][5]
+
+    assert message.materialize() == decoder().loads(pack(MESSAGE))
+    assert message == MESSAGE
+    assert dict(message.items())[u'op'] == 0
+
+
+def test_lazy_compressed_term():
+    packed = ErlangTermEncoder(compressed=True, compress_threshold=0).pack(MESSAGE)
+    assert packed[1:2] == b'P'
+    assert decoder().loads_lazy(packed)[u'd'][u'id'] == u'1234'
+
+
+def test_lazy_scalar_and_unread_errors():
+    assert unpack_lazy(pack(5)) == 5
+
+    # The broken value is only noticed when it is read.
+    broken = unpack_lazy(b'\x83t\x00\x00\x00\x02m\x00\x00\x00\x01aa\x01m\x00\x00\x00\x01bl\x00\x00\x00\x01a\x01a\x02')
+    assert broken[b'a'] == 1
+    with pytest.raises(NotImplementedError):
+        broken[b'b'][0]
@@ -0,0 +1,85 @@
+from __future__ import absolute_import
+import pytest
+
+from erlpack import ErlangTermEncoder, MapStream, pack, pack_into, unpack
+
+TERM = {'a': [1, 2.5, 'three'], 'b': (None, True)}
+
+
+def test_pack_into_bytearray():
+    buf = bytearray(64)
+    written = pack_into(TERM, buf)
+    assert written == len(pack(TERM))
+    assert bytes(buf[:written]) == pack(TERM)
+    assert buf[written:] == bytearray(64 - written)
+
+
+def test_pack_into_offset():
+    packed = pack(TERM)
+    buf = bytearray(b'\xff' * 100)
+    assert pack_into(TERM, buf, 10) == len(packed)
+    assert buf[:10] == b'\xff' * 10
+    assert bytes(buf[10:10 + len(packed)]) == packed
+    assert buf[10 + len(packed):] == b'\xff' * (90 - len(packed))
+
+
+def test_pack_into_memoryview():
+    packed = pack(TERM)
+    buf = bytearray(len(packed) + 4)
+    assert pack_into(TERM, memoryview(buf)[4:]) == len(packed)
+    assert bytes(buf[4:]) == packed
+
+
+def test_pack_into_exact_fit():
+    packed = pack(TERM)
+    buf = bytearray(len(packed))
+    assert pack_into(TERM, buf) == len(packed)
+    assert bytes(buf) == packed
+
+
+@pytest.mark.parametrize('term', [TERM, MapStream(iter([('a', 1)]))])
+def test_pack_into_overflow_leaves_buffer_untouched(term):
+    buf = bytearray(b'\xff' * 8)
+    with pytest.raises(ValueError):
+        pack_into(term, buf, 2)
+    assert buf == b'\xff' * 8
+
+
+def test_pack_into_unsized():
+    buf = bytearray(32)
+    written = pack_into(MapStream(iter([('a', 1)])), buf)
+    assert bytes(buf[:written]) == pack({'a': 1})
+
+
+def test_pack_into_compressed():
+    encoder = ErlangTermEncoder(compressed=True, compress_threshold=0)
+    term = ['hello world'] * 100
+    buf = bytearray(1024)
+    written = encoder.pack_into(term, buf)
+    assert bytes(buf[:written]) == encoder.pack(term)
+
+
+def test_pack_into_rejects():
+    with pytest.raises(BufferError):
+        pack_into(TERM, b'\x00' * 64)
+    with pytest.raises(ValueError):
+        pack_into(TERM, bytearray(64), 65)
+    with pytest.raises(ValueError):
+        pack_into(TERM, bytearray(64), -1)
+
+
+def test_pack_into_reads_properties_once():
+    class Shifty(object):
+        reads = 0
+
+        @property
+        def value(self):
+            Shifty.reads += 1
+            return [b'x' * 10, b'', b'x' * 100][min(Shifty.reads, 3) - 1]
+
+    encoder = ErlangTermEncoder()
+    encoder.register_schema(Shifty, fields=['value'])
+    buf = bytearray(64)
+    written = encoder.pack_into(Shifty(), buf)
+    assert unpack(bytes(buf[:written])) == {b'value': b'x' * 10}
+    assert Shifty.reads == 1
@@ -0,0 +1,65 @@
+from __future__ import absolute_import
+import pytest
+
+from erlpack import Atom, ErlangTermDecoder, ErlangTermEncoder, pack, unpack
+
+MESSAGE = {
+    u't': Atom('MESSAGE_CREATE'),
+    u'd': {u'guild_id': u'42', u'author': {u'id': u'7', u'name': u'x' * 100}, u'embeds': [{}, {u'url': u'u'}]},
+    u'op': 0,
+    5: u'five',
+}
+
+
+def decoder():
+    return ErlangTermDecoder(encoding='utf-8')
+
+
+def test_paths():
+    paths = [u't', (u'd', u'guild_id'), (u'd', u'author', u'id'), (u'd', u'embeds', 1, u'url'), 5, (u'op',)]
+    assert decoder().loads(pack(MESSAGE), paths=paths) == (
+        Atom('MESSAGE_CREATE'), u'42', u'7', u'u', u'five', 0)
+
+
+def test_missing_paths_give_default():
+    paths = [(u'd', u'nope'), (u'd', u'embeds', 5), (u'op', u'deeper'), (u'd', u'guild_id')]
+    assert decoder().loads(pack(MESSAGE), paths=paths) == (None, None, None, u'42')
+    assert decoder().loads(pack(MESSAGE), paths=[u'x'], default=0) == (0,)
+
+
+def test_paths_without_encoding():
+    assert unpack(pack(MESSAGE), paths=[(u'd', u'author', u'id'), (b'd', b'guild_id')]) == (b'7', b'42')
+
+
+def test_nested_paths():
+    author, author_id = decoder().loads(pack(MESSAGE), paths=[(u'd', u'author'), (u'd', u'author', u'id')])
+    assert author == MESSAGE[u'd'][u'author']
+    assert author_id == u'7'
+
+
+def test_negative_path_elements_are_only_map_keys():
+    term = {u'a': [1, 2, 3], u'b': {-1: u'neg', u'c': [4, 5]}}
+    # The same paths give the same values whether or not a prefix of them is decoded whole.
+    for paths in ([(u'a', -1)], [u'a', (u'a', -1)]):
+        assert decoder().loads(pack(term), paths=paths)[-1] is None
+    for paths in ([(u'b', u'c', -1)], [(u'b', u'c'), (u'b', u'c', -1)]):
+        assert decoder().loads(pack(term), paths=paths)[-1] is None
+    for paths in ([(u'b', -1)], [u'b', (u'b', -1)]):
+        assert decoder().loads(pack(term), paths=paths)[-1] == u'neg'
+
+
+def test_paths_in_compressed_term():
+    packed = ErlangTermEncoder(compressed=True, compress_threshold=0).pack(MESSAGE)
+    assert decoder().loads(packed, paths=[(u'd', u'guild_id')]) == (u'42',)
+
+
+def test_paths_skip_but_check_unread_terms():
+    # The guild id comes after a list whose arity passes the end of the buffer.
+    broken = b'\x83t\x00\x00\x00\x02m\x00\x00\x00\x01al\x00\x00\xff\xffjm\x00\x00\x00\x01ba\x01'
+    with pytest.raises(ValueError):
+        unpack(broken, paths=[b'b'])
+
+
+def test_bad_path_element():
+    with pytest.raises(TypeError):
+        unpack(pack(MESSAGE), paths=[(1.5,)])
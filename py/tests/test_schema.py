@@ -0,0 +1,144 @@
+from __future__ import absolute_import
+import collections
+import dataclasses
+import threading
+
+import pytest
+
+from erlpack import Atom, EncoderPool, ErlangTermEncoder, pack, unpack
+
+
+@dataclasses.dataclass
+class User:
+    id: int
+    name: str
+    tags: list
+
+
+class Point(object):
+    __slots__ = ('x', '__y')
+
+    def __init__(self, x, y):
+        self.x = x
+        self.__y = y
+
+
+class Point3(Point):
+    __slots__ = ('z',)
+
+    def __init__(self, x, y, z):
+        Point.__init__(self, x, y)
+        self.z = z
+
+
+Pair = collections.namedtuple('Pair', ['left', 'right'])
+
+
+class Plain(object):
+    def __init__(self, a):
+        self.a = a
+
+    @property
+    def double(self):
+        return self.a * 2
+
+
+def test_dataclass_as_map():
+    encoder = ErlangTermEncoder()
+    encoder.register_schema(User)
+    user = User(1, 'jake', ['a'])
+    assert encoder.pack(user) == pack({'id': 1, 'name': 'jake', 'tags': ['a']})
+    assert encoder.pack([user, {'u': user}]) == pack([dataclasses.asdict(user), {'u': dataclasses.asdict(user)}])
+
+
+def test_tuple_with_tag():
+    encoder = ErlangTermEncoder()
+    encoder.register_schema(User, as_='tuple', tag=Atom('user'))
+    assert encoder.pack(User(1, 'jake', [])) == pack((Atom('user'), 1, 'jake', []))
+
+
+def test_map_with_tag():
+    encoder = ErlangTermEncoder()
+    encoder.register_schema(User, fields=['id'], tag=Atom('Elixir.User'))
+    assert unpack(encoder.pack(User(1, 'jake', []))) == {Atom('__struct__'): Atom('Elixir.User'), b'id': 1}
+
+
+def test_atom_keys():
+    encoder = ErlangTermEncoder()
+    encoder.register_schema(User, fields=[Atom('id'), 'name'])
+    assert encoder.pack(User(1, 'jake', [])) == pack({Atom('id'): 1, 'name': 'jake'})
+
+
+def test_slots_and_subclasses():
+    encoder = ErlangTermEncoder()
+    encoder.register_schema(Point, as_='tuple')
+    assert encoder.pack(Point(1, 2)) == pack((1, 2))
+    # Subclasses use the schema of their base until they get their own.
+    assert encoder.pack(Point3(1, 2, 3)) == pack((1, 2))
+
+    encoder.register_schema(Point3, as_='tuple')
+    assert encoder.pack([Point3(1, 2, 3), Point(4, 5)]) == pack([(1, 2, 3), (4, 5)])
+
+    point = Point.__new__(Point)
+    with pytest.raises(AttributeError):
+        encoder.pack(point)
+
+
+def test_namedtuple():
+    encoder = ErlangTermEncoder()
+    encoder.register_schema(Pair)
+    assert encoder.pack(Pair(1, [2])) == pack({'left': 1, 'right': [2]})
+    assert encoder.pack(Pair(1, 2)) == pack({'left': 1, 'right': 2})
+
+
+def test_explicit_fields_and_properties():
+    encoder = ErlangTermEncoder()
+    encoder.register_schema(Plain, fields=['a', 'double'])
+    assert encoder.pack(Plain(2)) == pack({'a': 2, 'double': 4})
+
+    with pytest.raises(TypeError):
+        encoder.register_schema(Plain)
+
+
+def test_unsized_values():
+    encoder = ErlangTermEncoder(encode_hook=lambda obj: str(obj))
+    encoder.register_schema(User, as_='tuple')
+    assert encoder.pack(User(1, object, [])) == pack((1, str(object), []))
+
+
+def test_bad_schemas():
+    encoder = ErlangTermEncoder()
+    with pytest.raises(TypeError):
+        encoder.register_schema(dict)
+    with pytest.raises(TypeError):
+        encoder.register_schema(User(1, 'a', []))
+    with pytest.raises(ValueError):
+        encoder.register_schema(User, as_='list')
+
+
+def test_pool_schemas_reach_every_thread():
+    pool = EncoderPool()
+    pool.register_schema(Pair, as_='tuple')
+    results = []
+    thread = threading.Thread(target=lambda: results.append(pool.pack(Pair(1, 2))))
+    thread.start()
+    thread.join()
+    assert results == [pack((1, 2))]
+
+
+def test_properties_are_read_once():
+    class Growing(object):
+        def __init__(self):
+            self.reads = 0
+
+        @property
+        def value(self):
+            self.reads += 1
+            return 'x' * (10 * self.reads)
+
+    encoder = ErlangTermEncoder()
+    encoder.register_schema(Growing, fields=['value'])
+    growing = Growing()
+    packed = encoder.pack(growing)
+    assert unpack(packed)[b'value'] == b'x' * 10
+    assert growing.reads == 1
@@ -0,0 +1,39 @@
+from __future__ import absolute_import
+from erlpack import ErlangTermEncoder, pack
+
+
+def test_pack_segments_matches_pack():
+    blob = b'x' * 10000
+    obj = {'a': [blob, 1, u'small', blob], 'b': b'tiny'}
+    encoder = ErlangTermEncoder(segment_threshold=1024)
+
+    segments = encoder.pack_segments(obj)
+    assert all(isinstance(segment, memoryview) for segment in segments)
+    assert b''.join(segments) == pack(obj)
+
+
+def test_pack_segments_references_large_binaries():
+    blob = b'y' * 10000
+    encoder = ErlangTermEncoder(segment_threshold=1024)
+
+    segments = encoder.pack_segments([blob])
+    assert len(segments) == 3
+    assert segments[0] == b'\x83l\x00\x00\x00\x01m\x00\x00\x27\x10'
+    assert segments[1].obj is blob
+    assert segments[2] == b'j'
+
+
+def test_pack_segments_below_threshold():
+    encoder = ErlangTermEncoder(segment_threshold=1024)
+    segments = encoder.pack_segments(b'hello world')
+    assert len(segments) == 1
+    assert segments[0] == b'\x83m\x00\x00\x00\x0bhello world'
+
+
+def test_pack_segments_references_large_unicode():
+    text = u'é' * 5000
+    encoder = ErlangTermEncoder(segment_threshold=1024)
+
+    segments = encoder.pack_segments(text)
+    assert len(segments) == 2
+    assert b''.join(segments) == pack(text)
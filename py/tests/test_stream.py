@@ -0,0 +1,38 @@
+from __future__ import absolute_import
+import io
+
+import pytest
+
+from erlpack import ErlangTermEncoder, MapStream, pack, unpack
+
+
+def test_generator_packs_as_list():
+    assert pack(x * 2 for x in range(300)) == pack([x * 2 for x in range(300)])
+    assert pack({'rows': iter([1, u'two', (3,)])}) == pack({'rows': [1, u'two', (3,)]})
+
+
+def test_empty_iterator_packs_as_nil():
+    assert pack(iter([])) == pack([])
+    assert pack((x for x in ())) == b'\x83j'
+
+
+def test_map_stream():
+    rows = [(u'a', 1), (u'b', [1, 2]), (3, None)]
+    assert pack(MapStream(iter(rows))) == pack(dict(rows))
+    assert pack(MapStream([])) == pack({})
+    assert unpack(pack(MapStream((str(i), i) for i in range(1000)))) == {str(i).encode(): i for i in range(1000)}
+
+
+def test_map_stream_requires_pairs():
+    with pytest.raises(ValueError):
+        pack(MapStream([(1, 2, 3)]))
+
+
+def test_encode_hook_comes_before_streaming():
+    def encode_hook(obj):
+        if isinstance(obj, io.BytesIO):
+            return obj.getvalue()
+
+    encoder = ErlangTermEncoder(encode_hook=encode_hook)
+    assert encoder.pack(io.BytesIO(b'a\nb')) == pack(b'a\nb')
+    assert encoder.pack(iter([1, 2])) == pack([1, 2])
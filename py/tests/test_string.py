@@ -14,7 +14,7 @@ def test_string_null_byte():
 
 
 def test_string_ext_unpack():
-    assert unpack(b'\x83k\x0b\x00hello world') == \
+    assert unpack(b'\x83k\x00\x0bhello world') == \
         [104, 101, 108, 108, 111, 32, 119, 111, 114, 108, 100]
 
 def test_charlist_unpack():
@@ -0,0 +1,77 @@
+from __future__ import absolute_import
+import threading
+import time
+
+from erlpack import Fragment, ErlangTermEncoder, pack, unpack, unpack_lazy
+
+import pytest
+
+
+class Slow(object):
+    def __init__(self, value):
+        self.value = value
+
+    def __erlpack__(self):
+        # Lets other threads run while this one is in the middle of a pack.
+        time.sleep(0.001)
+        return self.value
+
+
+def run_threads(target, count=8):
+    errors = []
+
+    def work():
+        try:
+            target()
+        except Exception as e:
+            errors.append(e)
+
+    threads = [threading.Thread(target=work) for _ in range(count)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+    assert errors == []
+
+
+def test_module_pack_and_unpack_from_threads():
+    def work():
+        for i in range(20):
+            value = {'i': i, 'items': [Slow(i), 'x' * i]}
+            assert unpack(pack(value)) == {b'i': i, b'items': [i, b'x' * i]}
+            assert unpack_lazy(pack(value))[b'i'] == i
+
+    run_threads(work)
+
+
+def test_fragments_from_threads():
+    def work():
+        for i in range(20):
+            assert Fragment(Slow(i)).encoded == pack(i)[1:]
+
+    run_threads(work)
+
+
+def test_shared_encoder_is_still_exclusive():
+    encoder = ErlangTermEncoder()
+    started = threading.Event()
+    release = threading.Event()
+
+    class Blocking(object):
+        def __erlpack__(self):
+            started.set()
+            release.wait(5)
+            return 1
+
+    thread = threading.Thread(target=lambda: encoder.pack([Blocking()]))
+    thread.start()
+    started.wait(5)
+    try:
+        with pytest.raises(RuntimeError):
+            encoder.pack(1)
+    finally:
+        release.set()
+        thread.join()
+
+    assert encoder.pack(1) == pack(1)
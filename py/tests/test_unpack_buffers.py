@@ -0,0 +1,57 @@
+from __future__ import absolute_import
+import mmap
+import pytest
+
+from erlpack import Atom, ErlangTermDecoder, PID, Reference, pack, unpack
+from erlpack._unpacker import ErlangTermDecodeError
+
+TERM = {u'op': 0, u'd': [Atom('ready'), (1, 2.5, None), 2 ** 70]}
+
+
+def test_unpack_from_any_buffer():
+    packed = pack(TERM)
+    expected = unpack(packed)
+
+    assert unpack(bytearray(packed)) == expected
+    assert unpack(memoryview(packed)) == expected
+    assert unpack(memoryview(b'xx' + packed)[2:]) == expected
+
+    m = mmap.mmap(-1, len(packed))
+    m.write(packed)
+    assert unpack(m) == expected
+    m.close()
+
+
+def test_unpack_at_offset():
+    packed = pack(TERM)
+    assert ErlangTermDecoder().loads(b'junk' + packed, 4) == unpack(packed)
+
+
+def test_unpack_erlang_types():
+    pid = unpack(b'\x83gs\x0dnonode@nohost\x00\x00\x00\x25\x00\x00\x00\x00\x00')
+    assert isinstance(pid, PID)
+    assert (pid.node, pid.pid_id, pid.serial, pid.creation) == (Atom('nonode@nohost'), 37, 0, 0)
+
+    ref = unpack(b'\x83r\x00\x03s\x0dnonode@nohost\x00\x00\x00\x00\x01\x00\x00\x00\x02\x00\x00\x00\x03')
+    assert isinstance(ref, Reference)
+    assert (ref.node, ref.ref_id, ref.creation) == (Atom('nonode@nohost'), (1, 2, 3), 0)
+
+
+def test_unpack_rejects_malformed_terms():
+    with pytest.raises(ErlangTermDecodeError):
+        unpack(b'\x82j')
+
+    with pytest.raises(ErlangTermDecodeError):
+        unpack(b'\x83m\x00\x00\x00\x10short')
+
+    # An arity that cannot fit in the buffer fails before allocating anything.
+    with pytest.raises(ErlangTermDecodeError):
+        unpack(b'\x83l\xff\xff\xff\xffj')
+
+    with pytest.raises(ValueError):
+        unpack(b'\x83Z')
+
+
+def test_unpack_deep_nesting_is_bounded():
+    with pytest.raises(RecursionError):
+        unpack(b'\x83' + b'h\x01' * 100000 + b'j')
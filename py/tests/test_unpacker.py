@@ -0,0 +1,59 @@
+from __future__ import absolute_import
+import struct
+import pytest
+
+from erlpack import ErlangTermDecoder, Unpacker, pack
+from erlpack._unpacker import ErlangTermDecodeError
+
+TERMS = [1, u'two', [3, (4, 5)], {u'six': None}, b'x' * 300]
+
+
+def frame(term, packet=4):
+    packed = pack(term)
+    return struct.pack({1: '>B', 2: '>H', 4: '>I'}[packet], len(packed)) + packed
+
+
+@pytest.mark.parametrize('packet', [2, 4])
+def test_unpacker_byte_by_byte(packet):
+    stream = b''.join(frame(term, packet) for term in TERMS)
+    unpacker = Unpacker(packet=packet, decoder=ErlangTermDecoder(encoding='utf-8'))
+    decoded = []
+
+    for i in range(len(stream)):
+        unpacker.feed(stream[i:i + 1])
+        decoded.extend(unpacker)
+
+    assert decoded == [1, u'two', [3, (4, 5)], {u'six': None}, u'x' * 300]
+    assert unpacker.pending == 0
+
+
+def test_unpacker_keeps_partial_frames():
+    unpacker = Unpacker(packet=1)
+    data = frame(1, 1) + frame(u'two', 1)
+
+    unpacker.feed(bytearray(data[:-3]))
+    assert list(unpacker) == [1]
+    assert unpacker.pending == len(frame(u'two', 1)) - 3
+
+    unpacker.feed(memoryview(data)[-3:])
+    assert list(unpacker) == [b'two']
+    assert unpacker.pending == 0
+
+
+def test_unpacker_skips_bad_frames():
+    unpacker = Unpacker(packet=2)
+    unpacker.feed(b'\x00\x00' + b'\x00\x04\x83a\x01\x00' + frame(1, 2) + b'\x00\x02\x82j' + frame(2, 2))
+
+    with pytest.raises(ErlangTermDecodeError):
+        next(unpacker)
+    with pytest.raises(ErlangTermDecodeError):
+        next(unpacker)
+    assert next(unpacker) == 1
+    with pytest.raises(ErlangTermDecodeError):
+        next(unpacker)
+    assert list(unpacker) == [2]
+
+
+def test_unpacker_packet_sizes():
+    with pytest.raises(ValueError):
+        Unpacker(packet=3)
@@ -10,24 +10,36 @@ else:
     from setuptools.command.build_ext import build_ext
     from setuptools.extension import Extension
 
+# The packer deflates and the unpacker inflates COMPRESSED terms with the same
+# vendored zlib the node addon links against.
+zlib_sources = ['vendor/zlib/%s.c' % name for name in (
+    'adler32', 'compress', 'crc32', 'deflate', 'infback', 'inffast', 'inflate',
+    'inftrees', 'trees', 'uncompr', 'zutil',
+)]
+zlib_include_dirs = ['vendor/zlib']
+
 if use_cython:
     packer = Extension(
         "erlpack._packer",
         cython_cplus=True,
         extra_compile_args=['-O3'],
-        sources=["py/erlpack/_packer.pyx"]
+        include_dirs=zlib_include_dirs,
+        sources=["py/erlpack/_packer.pyx"] + zlib_sources
     )
     unpacker = Extension(
         "erlpack._unpacker",
         cython_cplus=True,
         extra_compile_args=['-O3'],
-        sources=["py/erlpack/_unpacker.pyx"]
+        include_dirs=zlib_include_dirs,
+        sources=["py/erlpack/_unpacker.pyx"] + zlib_sources
     )
 else:
     packer = Extension('erlpack._packer', sources=[
-                       'py/erlpack/_packer.cpp'], extra_compile_args=['-O3'])
+                       'py/erlpack/_packer.cpp'] + zlib_sources, include_dirs=zlib_include_dirs,
+                       extra_compile_args=['-O3'])
     unpacker = Extension('erlpack._unpacker', sources=[
-                         'py/erlpack/_unpacker.cpp'], extra_compile_args=['-O3'])
+                         'py/erlpack/_unpacker.cpp'] + zlib_sources, include_dirs=zlib_include_dirs,
+                         extra_compile_args=['-O3'])
 
 ext_modules = [packer, unpacker]
 